@@ -17,6 +17,7 @@
 #include <string.h>
 
 #include "sysinit/sysinit.h"
+#include "syscfg/syscfg.h"
 #include "os/os.h"
 #include "bsp/bsp.h"
 #include "hal/hal_gpio.h"
@@ -26,6 +27,9 @@
 
 #include "flashtask.h"
 #include "todoo_data.h"
+#include "todoo_image.h"
+#include "todoo_asset.h"
+#include "todoo_store.h"
 
 #include <SST26/SST26.h>
 
@@ -34,15 +38,145 @@
 
 static volatile int g_task1_loops;
 
+/* Pictures provisioned in the external memory, before the asset directory */
+static const struct {
+    uint16_t id;
+    uint32_t addr;
+} fixed_pics[] = {
+    { TODOO_ASSET_TEST_PIC,      ADD_TEST_PIC },
+    { TODOO_ASSET_ADV_REQ_PIC,   ADD_ADV_REQ_PIC },
+    { TODOO_ASSET_SHARING_PIC,   ADD_SHARING_PIC },
+    { TODOO_ASSET_FREE_TIME_PIC, ADD_FREE_TIME_PIC },
+    { TODOO_ASSET_BRAND_PIC,     ADD_BRAND_PIC }
+};
+
 /* FIFO global definition between gatt service task and flash task */
 array_type FIFO_task[FIFO_TASK_HEIGHT];
 
 FIFO_task_reader_type FIFO_task_reader = {
     .maxcnt = MAX_FIFO_WIDTH,
     .ptr    = (uint32_t)&FIFO_task,
-    .fline  = 0
+    .fline  = 0,
+    .rline  = 0
 };
 
+/*
+* Activity picture being received, NUM_BYTE_ACTIVITY_PIC bytes of 90x90
+* pixels, low byte first, for each activity of the schedule in turn.
+*/
+static struct todoo_store_wr pic_wr;
+static int pic_index = -1;          // Activity, -1 when there is none
+static int pic_count;               // Activities of the schedule
+static uint8_t pic_schedule;        // Schedule received with the pictures
+static uint32_t pic_off;            // Bytes received
+static uint8_t pic_stored;          // Going to the store, no error so far
+static uint8_t pic_low;             // Low byte of a pixel split between lines
+static uint8_t pic_buf[MAX_FIFO_WIDTH + 1];
+
+/*
+* Open the picture of activity pic_index in the image store.
+*/
+static void flash_pic_begin(void){
+    struct todoo_image_hdr hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TODOO_IMAGE_MAGIC;
+    hdr.format = TODOO_IMAGE_RGB565_BE;
+    hdr.hdr_len = sizeof(hdr);
+    hdr.width = 90;
+    hdr.height = 90;
+    hdr.len = NUM_BYTE_ACTIVITY_PIC;
+
+    pic_off = 0;
+    pic_stored = TODOO_ASSET_ACTIVITY(pic_index) < MYNEWT_VAL(TODOO_ASSET_MAX) &&
+                 todoo_store_begin(&pic_wr, TODOO_ASSET_ACTIVITY(pic_index), &hdr) == 0;
+}
+
+/*
+* Point the activity at its picture once stored, unless the gatt server
+* got a new schedule since: the check and the update can't be split by it.
+*/
+static void flash_pic_end(void){
+    const struct todoo_asset *asset;
+    os_sr_t sr;
+
+    if(pic_stored && todoo_store_commit(&pic_wr) == 0){
+        asset = todoo_asset_find(TODOO_ASSET_ACTIVITY(pic_index));
+        OS_ENTER_CRITICAL(sr);
+        if(asset && pic_schedule == todoo->schedule &&
+           pic_index < todoo->parameters->num_activity){
+            todoo->activity[pic_index].data_add  = asset->addr;
+            todoo->activity[pic_index].data_size = asset->len;
+        }
+        OS_EXIT_CRITICAL(sr);
+    }
+    pic_stored = 0;
+}
+
+/*
+* Store the bytes of a FIFO line in the pictures of the schedule.
+*/
+static void flash_receive(const array_type *line){
+    const uint8_t *data;
+    uint32_t len, chunk, i, n;
+
+    /* The lines left of an older schedule are dropped */
+    if(line->first || line->schedule != todoo->schedule){
+        if(pic_stored){
+            todoo_store_abort(&pic_wr);
+            pic_stored = 0;
+        }
+        pic_index = -1;
+        if(line->schedule != todoo->schedule){
+            return;
+        }
+        pic_count = line->num;
+        pic_schedule = line->schedule;
+        pic_off = 0;
+        if(pic_count > 0){
+            pic_index = 0;
+            flash_pic_begin();
+        }
+    }
+
+    data = line->buffer;
+    len = line->N;
+    while(len && pic_index >= 0){
+        chunk = NUM_BYTE_ACTIVITY_PIC - pic_off;
+        if(chunk > len){
+            chunk = len;
+        }
+
+        /* High byte first for the LCD */
+        n = 0;
+        for(i=0;i<chunk;i++){
+            if((pic_off + i) % 2 == 0){
+                pic_low = data[i];
+            }else{
+                pic_buf[n++] = data[i];
+                pic_buf[n++] = pic_low;
+            }
+        }
+        if(pic_stored && n && todoo_store_write(&pic_wr, pic_buf, n)){
+            todoo_store_abort(&pic_wr);
+            pic_stored = 0;
+        }
+
+        pic_off += chunk;
+        data += chunk;
+        len -= chunk;
+
+        if(pic_off == NUM_BYTE_ACTIVITY_PIC){
+            flash_pic_end();
+            if(++pic_index < pic_count){
+                flash_pic_begin();
+            }else{
+                pic_index = -1;
+            }
+        }
+    }
+}
+
 /* New task for the memory management */
 void
 flash_task_handler(void *arg)
@@ -60,37 +194,94 @@ flash_task_handler(void *arg)
         .ss_pin       = SPI_SS_PIN 
     };
 
-    struct sst26_dev *my_sst26_dev = NULL;
+    struct sst26_dev *dev = NULL;
     
-    my_sst26_dev = sst26_default_config();
-    my_sst26_dev->spi_num = 0;
-    my_sst26_dev->spi_cfg = &spi_cfg;
-    my_sst26_dev->ss_pin = spi_cfg.ss_pin;
+    dev = sst26_default_config();
+    dev->spi_num = 0;
+    dev->spi_cfg = &spi_cfg;
+    dev->ss_pin = spi_cfg.ss_pin;
 
-    
-    //int rc;
-    //rc = sst26_init((struct hal_flash *) my_sst26_dev);
-    //if (rc) {
+    /*
+    * This task owns the external memory device, the screen task waits
+    * for my_sst26_dev to be published and shares it: a single bus lock
+    * lets its reads suspend the erases started here.
+    */
+    int rc;
+    rc = sst26_init((struct hal_flash *) dev);
+    if (rc) {
         // XXX: error handling 
-    //}
-    
+    }
+
+    /*
+    * The pictures are flashed as BMP files at fixed addresses. The first
+    * time, convert them to the LCD format in the image store and list
+    * them in the asset directory, before the screen task can draw them.
+    */
+    int i;
+    todoo_asset_init(dev);
+    todoo_store_init(dev);
+    for(i=0;i<sizeof(fixed_pics)/sizeof(fixed_pics[0]);i++){
+        if(todoo_asset_find(fixed_pics[i].id) == NULL){
+            todoo_image_from_bmp(dev, fixed_pics[i].addr, fixed_pics[i].id);
+        }
+    }
+
+    /*
+    * Then the activity pictures, flashed as bare pixels one after the
+    * other, up to the first erased slot. They are converted from the last
+    * one down, so after a reset the slots left to convert are the ones in
+    * front of the first activity asset. The store is kept off them until
+    * then, parts of a picture can look erased, and gets each slot back
+    * once converted. The slots of the activity assets that follow were
+    * converted before, what may be left of them is handed back too.
+    */
+    int n, m;
+    uint32_t addr;
+    for(n=0;TODOO_ASSET_ACTIVITY(n)<MYNEWT_VAL(TODOO_ASSET_MAX);n++){
+        addr = ADD_FIRST_ACTIVITY_PIC + n * NUM_BYTE_ACTIVITY_PIC;
+        if(todoo_asset_find(TODOO_ASSET_ACTIVITY(n)) != NULL ||
+           todoo_store_owns(addr, NUM_BYTE_ACTIVITY_PIC) ||
+           todoo_image_raw_blank(dev, addr, 90, 90)){
+            break;
+        }
+    }
+    for(m=n;TODOO_ASSET_ACTIVITY(m)<MYNEWT_VAL(TODOO_ASSET_MAX);m++){
+        if(todoo_asset_find(TODOO_ASSET_ACTIVITY(m)) == NULL){
+            break;
+        }
+    }
+    todoo_store_reserve(ADD_FIRST_ACTIVITY_PIC, n * NUM_BYTE_ACTIVITY_PIC);
+    todoo_store_release(ADD_FIRST_ACTIVITY_PIC + n * NUM_BYTE_ACTIVITY_PIC,
+                        (m - n) * NUM_BYTE_ACTIVITY_PIC);
+    for(i=n;i-->0;){
+        addr = ADD_FIRST_ACTIVITY_PIC + i * NUM_BYTE_ACTIVITY_PIC;
+        if(todoo_image_from_raw(dev, addr, 90, 90, TODOO_ASSET_ACTIVITY(i))){
+            break;
+        }
+        todoo_store_release(addr, (m - i) * NUM_BYTE_ACTIVITY_PIC);
+    }
+
+    my_sst26_dev = dev;
+
 
     //static uint8_t warmtest = 0xaa;
     //sst26_write((struct hal_flash *) my_sst26_dev, 0, &warmtest, 1);
     //sst26_write((struct hal_flash *) my_sst26_dev, addr, buf, len);
     //sst26_read((struct hal_flash *) my_sst26_dev, addr, buf, len);
 
-    static uint32_t addr = ADD_FIRST_ACTIVITY_PIC;
-
     while (1) {
         ++g_task1_loops;
 
 
-        if(FIFO_task_reader.fline != 0){
-            -- FIFO_task_reader.fline;
-            //sst26_write((struct hal_flash *) my_sst26_dev, addr, &FIFO_task[FIFO_task_reader.fline], FIFO_task[FIFO_task_reader.fline].N);
-            addr+=FIFO_task[FIFO_task_reader.fline].N;
+        /* Pictures received by the gatt server go to the image store */
+        while(FIFO_task_reader.rline != FIFO_task_reader.fline){
+            flash_receive(&FIFO_task[FIFO_task_reader.rline]);
+            FIFO_task_reader.rline = (FIFO_task_reader.rline + 1) % FIFO_TASK_HEIGHT;
         }
+
+        /* Reclaim the sectors of replaced pictures in the background */
+        todoo_store_gc();
+
         /* Wait 1/6 second */
         os_time_delay(OS_TICKS_PER_SEC/6);
     }
@@ -27,18 +27,29 @@ void flash_task_handler(void *arg);
 #define DC_LCD    (15)
 #define PWM_LCD   (14)
 
+/*
+* Lines of picture bytes received by the gatt server, in a ring: written at
+* fline by the gatt server, read at rline by the flash task.
+*/
 typedef struct array
 {
     uint8_t buffer[MAX_FIFO_WIDTH];
     uint8_t N;
+    uint8_t first;  // First line of a new schedule
+    uint8_t num;    // Activities of the schedule
+    uint8_t schedule;   // Schedule the pictures are for (todoo->schedule)
 } array_type;
 
 typedef struct task_reader
 {
     uint32_t maxcnt;
     uint32_t ptr;
-    uint8_t fline;
+    volatile uint8_t fline;
+    volatile uint8_t rline;
 } FIFO_task_reader_type;
 
 extern array_type FIFO_task[FIFO_TASK_HEIGHT];
 extern FIFO_task_reader_type FIFO_task_reader;
+
+/* External memory shared by the tasks, set once initialized by flash task */
+extern struct sst26_dev *my_sst26_dev;
@@ -65,6 +65,7 @@
 #include "mcu/nrf52_hal.h"
 
 #include "todoo_data.h"
+#include "todoo_asset.h"
 
 
 
@@ -146,6 +147,32 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
     },
 };
 
+/*
+* Queue picture bytes for the flash task, -1 if the FIFO is full.
+*/
+static int
+gatt_svr_fifo_put(const uint8_t *data, uint16_t len, uint8_t first)
+{
+    array_type *line;
+    uint8_t next;
+
+    next = (FIFO_task_reader.fline + 1) % FIFO_TASK_HEIGHT;
+    if (next == FIFO_task_reader.rline) {
+        return -1;
+    }
+
+    line = &FIFO_task[FIFO_task_reader.fline];
+    memcpy(line->buffer, data, len);
+    line->N = len;
+    line->first = first;
+    line->num = todoo->parameters->num_activity;
+    line->schedule = todoo->schedule;
+
+    /* Published once filled */
+    FIFO_task_reader.fline = next;
+    return 0;
+}
+
 static int
 gatt_svr_chr_write(struct os_mbuf *om, uint16_t min_len, uint16_t max_len,
                    void *dst, uint16_t *len)
@@ -173,6 +200,9 @@ gatt_svr_chr_trans_data(uint16_t conn_handle, uint16_t attr_handle,
                              void *arg)
 {
     const ble_uuid_t *uuid;
+    uint16_t len;
+    uint16_t head;
+    uint8_t num;
     int rc;
     static uint8_t first_packet=1;
 
@@ -194,13 +224,20 @@ gatt_svr_chr_trans_data(uint16_t conn_handle, uint16_t attr_handle,
             rc = gatt_svr_chr_write(ctxt->om,
                                     1, //sizeof gatt_svr_data_trans
                                     sizeof gatt_svr_data_trans,
-                                    &gatt_svr_data_trans[0], NULL);
+                                    &gatt_svr_data_trans[0], &len);
+            if (rc != 0) {
+                return rc;
+            }
             
             
             if(first_packet){
+                if (len < 6) {
+                    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+                }
+
                 /* 
-                * Initialize the data structure todoo and allocate 
-                * enough memory depending of the number of activities
+                * Initialize the data structure todoo, the activities
+                * go in the array allocated once by init_todoo()
                 */
                 /*
                 todoo = malloc(sizeof(struct Todoo_data));
@@ -210,23 +247,48 @@ gatt_svr_chr_trans_data(uint16_t conn_handle, uint16_t attr_handle,
                 todoo->parameters->time[B_MIN]  = gatt_svr_data_trans[2];
                 todoo->parameters->time[B_SEC]  = gatt_svr_data_trans[3];
                 todoo->parameters->day  = gatt_svr_data_trans[4];
-                todoo->parameters->num_activity  = gatt_svr_data_trans[5];
 
-                todoo->activity = malloc(todoo->parameters->num_activity*sizeof(struct Activity));
-         
+                /*
+                * A new schedule: the flash task drops what it still has
+                * to store for the previous one, its pictures no longer
+                * change the activities.
+                */
+                todoo->schedule++;
+                num = gatt_svr_data_trans[5];
+                if (num > (len - 6) / 5) {
+                    num = (len - 6) / 5;
+                }
+                if (num > MAX_ACTIVITY_SCHEDULE) {
+                    num = MAX_ACTIVITY_SCHEDULE;
+                }
+                todoo->parameters->num_activity = num;
+
                 int i_act=0;
+                struct todoo_asset asset;
                 for(i_act=0;i_act<todoo->parameters->num_activity;i_act++){
                     todoo->activity[i_act].day  = gatt_svr_data_trans[6+i_act*5];
                     todoo->activity[i_act].start_time[B_HOUR] = gatt_svr_data_trans[7+i_act*5];
                     todoo->activity[i_act].start_time[B_MIN]  = gatt_svr_data_trans[8+i_act*5];
                     todoo->activity[i_act].end_time[B_HOUR] = gatt_svr_data_trans[9+i_act*5];
                     todoo->activity[i_act].end_time[B_MIN]  = gatt_svr_data_trans[10+i_act*5];
-                    todoo->activity[i_act].data_add  = ADD_FIRST_ACTIVITY_PIC+i_act*NUM_BYTE_ACTIVITY_PIC;
+                    if (todoo_asset_get(TODOO_ASSET_ACTIVITY(i_act), &asset) == 0) {
+                        todoo->activity[i_act].data_add  = asset.addr;
+                        todoo->activity[i_act].data_size = asset.len;
+                        todoo_asset_put(&asset);
+                    } else {
+                        todoo->activity[i_act].data_add  = 0;
+                        todoo->activity[i_act].data_size = 0;
+                    }
                 }
 
-                //memcpy(&FIFO_task[FIFO_task_reader.fline], &gatt_svr_data_trans[11*todoo->parameters->num_activity], MESSAGE_SIZE-11*todoo->parameters->num_activity);
-                FIFO_task[FIFO_task_reader.fline].N = MESSAGE_SIZE-11*todoo->parameters->num_activity;
-                FIFO_task_reader.fline ++;
+                /* The pictures start right after the activities */
+                head = 6 + 5 * todoo->parameters->num_activity;
+                if (head > len) {
+                    head = len;
+                }
+                if (gatt_svr_fifo_put(&gatt_svr_data_trans[head], len - head, 1)) {
+                    return BLE_ATT_ERR_INSUFFICIENT_RES;
+                }
                 first_packet = 0;
 
                 todoo->config_state = 1;
@@ -260,9 +322,11 @@ gatt_svr_chr_trans_data(uint16_t conn_handle, uint16_t attr_handle,
                //LCD_IO_WriteMultipleData((uint8_t*) &gatt_svr_data_trans[11], MESSAGE_SIZE-11);
             }else
             {
-                //memcpy(&FIFO_task[FIFO_task_reader.fline], &gatt_svr_data_trans[1], MESSAGE_SIZE-1);
-                FIFO_task[FIFO_task_reader.fline].N = MESSAGE_SIZE-1;
-                FIFO_task_reader.fline ++;
+                /* The first byte of the next packets isn't picture data */
+                if (len > 1 &&
+                    gatt_svr_fifo_put(&gatt_svr_data_trans[1], len - 1, 0)) {
+                    return BLE_ATT_ERR_INSUFFICIENT_RES;
+                }
 
                 //state->which =  shows_activity;
                 //state->config = 1;
@@ -84,6 +84,7 @@ typedef struct
   uint16_t (*GetLcdPixelHeight)(void);
   void     (*DrawBitmap)(uint16_t, uint16_t, uint8_t*);
   void     (*DrawRGBImage)(uint16_t, uint16_t, uint16_t, uint16_t, uint8_t*);
+  void     (*FillWindow)(uint16_t, uint16_t, uint16_t, uint16_t, uint16_t);
 }LCD_DrvTypeDef;
 
 /**
@@ -64,6 +64,8 @@
 /** @defgroup ST7735_Private_Defines
   * @{
   */
+#define ST7735_SEQ_DELAY      0x80
+#define ST7735_SEQ_MAX_ARGS   16
 
 /**
   * @}
@@ -97,10 +99,75 @@ LCD_DrvTypeDef   st7735_drv =
   st7735_GetLcdPixelWidth,
   st7735_GetLcdPixelHeight,
   st7735_DrawBitmap,
+  st7735_DrawRGBImage,
+  st7735_FillWindow,
 };
 
 static uint16_t ArrayRGB[320] = {0};
 
+/* Command sequences: command, number of arguments, ST7735_SEQ_DELAY added
+   when a delay in LCD_Delay() units follows the arguments, arguments */
+static const uint8_t st7735_InitSeq[] =
+{
+  /* Out of sleep mode, 0 args, 5 ms at least before the next command */
+  LCD_REG_17,  0 | ST7735_SEQ_DELAY, 2,
+  /* Frame rate ctrl - normal mode, 3 args:Rate = fosc/(1x2+40) * (LINE+2C+2D)*/
+  LCD_REG_177, 3, 0x01, 0x2C, 0x2D,
+  /* Frame rate control - idle mode, 3 args:Rate = fosc/(1x2+40) * (LINE+2C+2D) */
+  LCD_REG_178, 3, 0x01, 0x2C, 0x2D,
+  /* Frame rate ctrl - partial mode, 6 args: Dot inversion mode, Line inversion mode */
+  LCD_REG_179, 6, 0x01, 0x2C, 0x2D, 0x01, 0x2C, 0x2D,
+  /* Display inversion ctrl, 1 arg, no delay: No inversion */
+  LCD_REG_180, 1, 0x07,
+  /* Power control, 3 args, no delay: -4.6V , AUTO mode */
+  LCD_REG_192, 3, 0xA2, 0x02, 0x84,
+  /* Power control, 1 arg, no delay: VGH25 = 2.4C VGSEL = -10 VGH = 3 * AVDD */
+  LCD_REG_193, 1, 0xC5,
+  /* Power control, 2 args, no delay: Opamp current small, Boost frequency */
+  LCD_REG_194, 2, 0x0A, 0x00,
+  /* Power control, 2 args, no delay: BCLK/2, Opamp current small & Medium low */
+  LCD_REG_195, 2, 0x8A, 0x2A,
+  /* Power control, 2 args, no delay */
+  LCD_REG_196, 2, 0x8A, 0xEE,
+  /* Power control, 1 arg, no delay */
+  LCD_REG_197, 1, 0x0E,
+  /* Don't invert display, no args, no delay */
+  LCD_REG_32,  0,
+  /* Set color mode, 1 arg, no delay: 16-bit color */
+  LCD_REG_58,  1, 0x05,
+  /* Column addr set, 4 args, no delay: XSTART = 0, XEND = 127 */
+  LCD_REG_42,  4, 0x00, 0x00, 0x00, 0x7F,
+  /* Row addr set, 4 args, no delay: YSTART = 0, YEND = 127 */
+  LCD_REG_43,  4, 0x00, 0x00, 0x00, 0x7F,
+  /* Magical unicorn dust, 16 args, no delay */
+  LCD_REG_224, 16, 0x02, 0x1c, 0x07, 0x12, 0x37, 0x32, 0x29, 0x2d,
+                   0x29, 0x25, 0x2B, 0x39, 0x00, 0x01, 0x03, 0x10,
+  /* Sparkles and rainbows, 16 args, no delay */
+  LCD_REG_225, 16, 0x03, 0x1d, 0x07, 0x06, 0x2E, 0x2C, 0x29, 0x2D,
+                   0x2E, 0x2E, 0x37, 0x3F, 0x00, 0x00, 0x02, 0x10,
+  /* Normal display on, no args, no delay */
+  LCD_REG_19,  0,
+  /* Main screen turn on, no delay */
+  LCD_REG_41,  0,
+  /* Memory access control: MY = 1, MX = 1, MV = 0, ML = 0 */
+  LCD_REG_54,  1, 0x68,
+};
+
+/* The display switches at the next frame, no wait is needed */
+static const uint8_t st7735_OnSeq[] =
+{
+  LCD_REG_19,  0,
+  LCD_REG_41,  0,
+  LCD_REG_54,  1, 0x68,
+};
+
+static const uint8_t st7735_OffSeq[] =
+{
+  LCD_REG_19,  0,
+  LCD_REG_40,  0,
+  LCD_REG_54,  1, 0x68,
+};
+
 /**
 * @}
 */ 
@@ -117,6 +184,45 @@ static uint16_t ArrayRGB[320] = {0};
   * @{
   */
 
+/**
+  * @brief  Sends a sequence of commands, each under one chip select with
+  *         its arguments sent at once.
+  * @param  pSeq: commands, see st7735_InitSeq.
+  * @param  Size: size of the sequence in bytes.
+  * @retval None
+  */
+static void st7735_WriteSequence(const uint8_t *pSeq, uint32_t Size)
+{
+  uint8_t args[ST7735_SEQ_MAX_ARGS];
+  uint32_t index = 0, counter = 0;
+  uint8_t nargs = 0;
+  
+  while(index + 1 < Size)
+  {
+    nargs = pSeq[index + 1] & ~ST7735_SEQ_DELAY;
+    
+    LCD_IO_Begin();
+    LCD_IO_WriteReg(pSeq[index]);
+    if(nargs > 0)
+    {
+      /* Sent as they are, the copy is received over */
+      for(counter = 0; counter < nargs; counter++)
+      {
+        args[counter] = pSeq[index + 2 + counter];
+      }
+      LCD_IO_WritePixels(args, nargs);
+    }
+    LCD_IO_End();
+    
+    if(pSeq[index + 1] & ST7735_SEQ_DELAY)
+    {
+      LCD_Delay(pSeq[index + 2 + nargs]);
+      index++;
+    }
+    index += 2 + nargs;
+  }
+}
+
 /**
   * @brief  Initialize the ST7735 LCD Component.
   * @param  None
@@ -124,170 +230,10 @@ static uint16_t ArrayRGB[320] = {0};
   */
 void st7735_Init(void)
 {    
-  uint8_t data = 0;
-  
   /* Initialize ST7735 low level bus layer -----------------------------------*/
   LCD_IO_Init();
-  /* Out of sleep mode, 0 args, no delay */
-  st7735_WriteReg(LCD_REG_17, 0x00); 
-    /* Frame rate ctrl - normal mode, 3 args:Rate = fosc/(1x2+40) * (LINE+2C+2D)*/
-    LCD_IO_WriteReg(LCD_REG_177);
-    data = 0x01;
-    LCD_IO_WriteMultipleData(&data, 1);
-    data = 0x2C;
-    LCD_IO_WriteMultipleData(&data, 1);
-    data = 0x2D;
-      /* Frame rate control - idle mode, 3 args:Rate = fosc/(1x2+40) * (LINE+2C+2D) */ 
-  LCD_IO_WriteReg(LCD_REG_178);
-  data = 0x01;
-  LCD_IO_WriteMultipleData(&data, 1);
-  data = 0x2C;
-  LCD_IO_WriteMultipleData(&data, 1);
-  data = 0x2D;
-  LCD_IO_WriteMultipleData(&data, 1);
-    /* Frame rate ctrl - partial mode, 6 args: Dot inversion mode, Line inversion mode */ 
-    LCD_IO_WriteReg(LCD_REG_179);
-    data = 0x01;
-    LCD_IO_WriteMultipleData(&data, 1);
-    data = 0x2C;
-    LCD_IO_WriteMultipleData(&data, 1);
-    data = 0x2D;
-    LCD_IO_WriteMultipleData(&data, 1);
-    data = 0x01;
-    LCD_IO_WriteMultipleData(&data, 1);
-    data = 0x2C;
-    LCD_IO_WriteMultipleData(&data, 1);
-    data = 0x2D;
-    LCD_IO_WriteMultipleData(&data, 1);
-      /* Display inversion ctrl, 1 arg, no delay: No inversion */
-    st7735_WriteReg(LCD_REG_180, 0x07);
-      /* Power control, 3 args, no delay: -4.6V , AUTO mode */
-  LCD_IO_WriteReg(LCD_REG_192);
-  data = 0xA2;
-  LCD_IO_WriteMultipleData(&data, 1);
-  data = 0x02;
-  LCD_IO_WriteMultipleData(&data, 1);
-  data = 0x84;
-  LCD_IO_WriteMultipleData(&data, 1);
-    /* Power control, 1 arg, no delay: VGH25 = 2.4C VGSEL = -10 VGH = 3 * AVDD */
-    st7735_WriteReg(LCD_REG_193, 0xC5);
-      /* Power control, 2 args, no delay: Opamp current small, Boost frequency */ 
-  LCD_IO_WriteReg(LCD_REG_194);
-  data = 0x0A;
-  LCD_IO_WriteMultipleData(&data, 1);
-  data = 0x00;
-  LCD_IO_WriteMultipleData(&data, 1);
-    /* Power control, 2 args, no delay: BCLK/2, Opamp current small & Medium low */  
-    LCD_IO_WriteReg(LCD_REG_195);
-    data = 0x8A;
-    LCD_IO_WriteMultipleData(&data, 1);
-    data = 0x2A;
-    LCD_IO_WriteMultipleData(&data, 1);
-      /* Power control, 2 args, no delay */
-  LCD_IO_WriteReg(LCD_REG_196);
-  data = 0x8A;
-  LCD_IO_WriteMultipleData(&data, 1);
-  data = 0xEE;
-  LCD_IO_WriteMultipleData(&data, 1);
-  /* Power control, 1 arg, no delay */
-  st7735_WriteReg(LCD_REG_197, 0x0E);
-    /* Don't invert display, no args, no delay */
-    LCD_IO_WriteReg(LCD_REG_32);
-     /* Set color mode, 1 arg, no delay: 16-bit color */
-  LCD_IO_WriteReg(LCD_REG_58);
-  data = 0x05;
-  LCD_IO_WriteMultipleData(&data, 1);
-    /* Column addr set, 4 args, no delay: XSTART = 0, XEND = 127 */
-    LCD_IO_WriteReg(LCD_REG_42);
-    data = 0x00;
-    LCD_IO_WriteMultipleData(&data, 1);
-    LCD_IO_WriteMultipleData(&data, 1);
-    LCD_IO_WriteMultipleData(&data, 1);
-    data = 0x7F; //83 //7F   
-    LCD_IO_WriteMultipleData(&data, 1);
-    /* Row addr set, 4 args, no delay: YSTART = 0, YEND = 159 */
-    LCD_IO_WriteReg(LCD_REG_43);
-    data = 0x00;
-    LCD_IO_WriteMultipleData(&data, 1);
-    LCD_IO_WriteMultipleData(&data, 1);
-    LCD_IO_WriteMultipleData(&data, 1);
-    data = 0x7F; //83  //9F //7F
-    LCD_IO_WriteMultipleData(&data, 1);
-      /* Magical unicorn dust, 16 args, no delay */
-  LCD_IO_WriteReg(LCD_REG_224);
-  data = 0x02;
-  LCD_IO_WriteMultipleData(&data, 1);
-  data = 0x1c;
-  LCD_IO_WriteMultipleData(&data, 1);
-  data = 0x07;
-  LCD_IO_WriteMultipleData(&data, 1); 
-  data = 0x12;
-  LCD_IO_WriteMultipleData(&data, 1); 
-  data = 0x37;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x32;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x29;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x2d;
-  LCD_IO_WriteMultipleData(&data, 1); 
-  data = 0x29;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x25;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x2B;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x39;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x00;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x01;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x03;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x10;
-  LCD_IO_WriteMultipleData(&data, 1);
-  /* Sparkles and rainbows, 16 args, no delay */
-  LCD_IO_WriteReg(LCD_REG_225);
-  data =  0x03;
-  LCD_IO_WriteMultipleData(&data, 1);
-  data =  0x1d ;
-  LCD_IO_WriteMultipleData(&data, 1); 
-  data = 0x07;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x06;
-  LCD_IO_WriteMultipleData(&data, 1); 
-  data = 0x2E;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x2C;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x29;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x2D;
-  LCD_IO_WriteMultipleData(&data, 1); 
-  data = 0x2E;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x2E;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x37;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x3F;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x00;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x00;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x02;
-  LCD_IO_WriteMultipleData(&data, 1);   
-  data = 0x10;
-  LCD_IO_WriteMultipleData(&data, 1); 
-
-  /* Normal display on, no args, no delay */
-  st7735_WriteReg(LCD_REG_19, 0x00);
-  /* Main screen turn on, no delay */
-  st7735_WriteReg(LCD_REG_41, 0x00);
-  /* Memory access control: MY = 1, MX = 1, MV = 0, ML = 0 */
-  st7735_WriteReg(LCD_REG_54, 0x68); //0x60 //0xC8
+  
+  st7735_WriteSequence(st7735_InitSeq, sizeof(st7735_InitSeq));
 }
 
 /**
@@ -297,14 +243,7 @@ void st7735_Init(void)
   */
 void st7735_DisplayOn(void)
 {
-  uint8_t data = 0;
-  LCD_IO_WriteReg(LCD_REG_19);
-  LCD_Delay(10);
-  LCD_IO_WriteReg(LCD_REG_41);
-  LCD_Delay(10);
-  LCD_IO_WriteReg(LCD_REG_54);
-  data = 0x68; ////0x60 0xC8 0xC0
-  LCD_IO_WriteMultipleData(&data, 1);
+  st7735_WriteSequence(st7735_OnSeq, sizeof(st7735_OnSeq));
 }
 
 /**
@@ -314,14 +253,7 @@ void st7735_DisplayOn(void)
   */
 void st7735_DisplayOff(void)
 {
-  uint8_t data = 0;
-  LCD_IO_WriteReg(LCD_REG_19);
-  LCD_Delay(10);
-  LCD_IO_WriteReg(LCD_REG_40);
-  LCD_Delay(10);
-  LCD_IO_WriteReg(LCD_REG_54);
-  data = 0x68; //0xC0
-  LCD_IO_WriteMultipleData(&data, 1);
+  st7735_WriteSequence(st7735_OffSeq, sizeof(st7735_OffSeq));
 }
 
 /**
@@ -334,6 +266,7 @@ void st7735_SetCursor(uint16_t Xpos, uint16_t Ypos)
 {
   uint8_t data = 0;
   //HAL_Delay(2);/////////////////////////////////////////////////////
+  LCD_IO_Begin();
   LCD_IO_WriteReg(LCD_REG_42);
   data = (Xpos) >> 8;
   LCD_IO_WriteMultipleData(&data, 1);
@@ -345,7 +278,7 @@ void st7735_SetCursor(uint16_t Xpos, uint16_t Ypos)
   data = (Ypos) & 0xFF;
   LCD_IO_WriteMultipleData(&data, 1);
   LCD_IO_WriteReg(LCD_REG_44);
-
+  LCD_IO_End();
 }
 
 /**
@@ -363,6 +296,8 @@ void st7735_WritePixel(uint16_t Xpos, uint16_t Ypos, uint16_t RGBCode)
     return;
   }
   
+  LCD_IO_Begin();
+  
   /* Set Cursor */
   st7735_SetCursor(Xpos, Ypos);
   
@@ -370,6 +305,8 @@ void st7735_WritePixel(uint16_t Xpos, uint16_t Ypos, uint16_t RGBCode)
   LCD_IO_WriteMultipleData(&data, 1);
   data = RGBCode;
   LCD_IO_WriteMultipleData(&data, 1);
+  
+  LCD_IO_End();
 }  
 
 
@@ -381,8 +318,10 @@ void st7735_WritePixel(uint16_t Xpos, uint16_t Ypos, uint16_t RGBCode)
   */
 void st7735_WriteReg(uint8_t LCDReg, uint8_t LCDRegValue)
 {
+  LCD_IO_Begin();
   LCD_IO_WriteReg(LCDReg);
   LCD_IO_WriteMultipleData(&LCDRegValue, 1);
+  LCD_IO_End();
 }
 
 /**
@@ -396,6 +335,7 @@ void st7735_WriteReg(uint8_t LCDReg, uint8_t LCDRegValue)
 void st7735_SetDisplayWindow(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height)
 {
   uint8_t data = 0;
+  LCD_IO_Begin();
   /* Column addr set, 4 args, no delay: XSTART = Xpos, XEND = (Xpos + Width - 1) */
   LCD_IO_WriteReg(LCD_REG_42);
   data = (Xpos) >> 8;
@@ -416,6 +356,7 @@ void st7735_SetDisplayWindow(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint1
   LCD_IO_WriteMultipleData(&data, 1);
   data = (Ypos + Height - 1) & 0xFF;
   LCD_IO_WriteMultipleData(&data, 1);
+  LCD_IO_End();
 }
 
 /**
@@ -432,14 +373,19 @@ void st7735_DrawHLine(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t L
   
   if(Xpos + Length > ST7735_LCD_PIXEL_WIDTH) return;
   
-  /* Set Cursor */
-  st7735_SetCursor(Xpos, Ypos);
-  
   for(counter = 0; counter < Length; counter++)
   {
     ArrayRGB[counter] = RGBCode;
   }
+  
+  LCD_IO_Begin();
+  
+  /* Set Cursor */
+  st7735_SetCursor(Xpos, Ypos);
+  
   LCD_IO_WriteMultipleData((uint8_t*)&ArrayRGB[0], Length * 2);
+  
+  LCD_IO_End();
 }
 
 /**
@@ -452,13 +398,54 @@ void st7735_DrawHLine(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t L
   */
 void st7735_DrawVLine(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Length)
 {
-  uint8_t counter = 0;
-  
   if(Ypos + Length > ST7735_LCD_PIXEL_HEIGHT) return;
-  for(counter = 0; counter < Length; counter++)
+  if(Xpos >= ST7735_LCD_PIXEL_WIDTH) return;
+  
+  /* A window one column wide */
+  st7735_FillWindow(RGBCode, Xpos, Ypos, 1, Length);
+}
+
+/**
+  * @brief  Fills a window with a color: the window is set once and the
+  *         color sent in bursts of ArrayRGB. It's the whole LCD again
+  *         afterwards, as st7735_SetCursor() expects.
+  * @param  RGBCode: Specifies the RGB color   
+  * @param  Xpos: specifies the X position.
+  * @param  Ypos: specifies the Y position.
+  * @param  Width: window width.
+  * @param  Height: window height.
+  * @retval None
+  */
+void st7735_FillWindow(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height)
+{
+  uint8_t *burst = (uint8_t *)&ArrayRGB[0];
+  uint32_t size = 0, counter = 0, len = 0;
+  
+  if((Width == 0) || (Height == 0)) return;
+  
+  LCD_IO_Begin();
+  
+  st7735_SetDisplayWindow(Xpos, Ypos, Width, Height);
+  LCD_IO_WriteReg(LCD_REG_44);
+  
+  size = (uint32_t)Width * Height * 2;
+  while(size > 0)
   {
-    st7735_WritePixel(Xpos, Ypos + counter, RGBCode);
-  }   
+    len = size < sizeof(ArrayRGB) ? size : sizeof(ArrayRGB);
+    
+    /* High byte first, the burst is received over */
+    for(counter = 0; counter < len; counter += 2)
+    {
+      burst[counter] = RGBCode >> 8;
+      burst[counter + 1] = RGBCode;
+    }
+    LCD_IO_WritePixels(burst, len);
+    size -= len;
+  }
+  
+  st7735_SetDisplayWindow(0, 0, ST7735_LCD_PIXEL_WIDTH, ST7735_LCD_PIXEL_HEIGHT);
+  
+  LCD_IO_End();
 }
 
 /**
@@ -499,6 +486,8 @@ void st7735_DrawBitmap(uint16_t Xpos, uint16_t Ypos, uint8_t *pbmp)
   size = (size - index)/2;
   pbmp += index;
   
+  LCD_IO_Begin();
+  
   /* Set GRAM write direction and BGR = 0 */
   /* Memory access control: MY = 0, MX = 1, MV = 0, ML = 0 */
   st7735_WriteReg(LCD_REG_54, 0x48);
@@ -507,12 +496,39 @@ void st7735_DrawBitmap(uint16_t Xpos, uint16_t Ypos, uint8_t *pbmp)
   st7735_SetCursor(Xpos, Ypos);  
  
   LCD_IO_WriteMultipleData((uint8_t*)pbmp, size*2);
+  
+  LCD_IO_End();
  
   /* Set GRAM write direction and BGR = 0 */
   /* Memory access control: MY = 1, MX = 1, MV = 0, ML = 0 */
   //st7735_WriteReg(LCD_REG_54, 0xC0);
 }
 
+/**
+  * @brief  Displays RGB565 pixels, high byte first, sent at once. The
+  *         window is set by the caller, Xpos and Ypos are in it.
+  * @param  Xpos: specifies the X position.
+  * @param  Ypos: specifies the Y position.
+  * @param  Xsize: width of the image.
+  * @param  Ysize: height of the image.
+  * @param  pdata: pixels, they are received over.
+  * @retval None
+  */
+void st7735_DrawRGBImage(uint16_t Xpos, uint16_t Ypos, uint16_t Xsize, uint16_t Ysize, uint8_t *pdata)
+{
+  LCD_IO_Begin();
+
+  /* Memory access control: MY = 0, MX = 1, MV = 0, ML = 0 */
+  st7735_WriteReg(LCD_REG_54, 0x48);
+
+  /* Set Cursor */
+  st7735_SetCursor(Xpos, Ypos);
+
+  LCD_IO_WritePixels(pdata, (uint32_t)Xsize*Ysize*2);
+
+  LCD_IO_End();
+}
+
 /**
 * @}
 */ 
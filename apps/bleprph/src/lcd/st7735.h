@@ -139,10 +139,12 @@ uint8_t  st7735_ReadReg(uint8_t LCDReg);
 void     st7735_SetDisplayWindow(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height);
 void     st7735_DrawHLine(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Length);
 void     st7735_DrawVLine(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Length);
+void     st7735_FillWindow(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height);
 
 uint16_t st7735_GetLcdPixelWidth(void);
 uint16_t st7735_GetLcdPixelHeight(void);
 void     st7735_DrawBitmap(uint16_t Xpos, uint16_t Ypos, uint8_t *pbmp);
+void     st7735_DrawRGBImage(uint16_t Xpos, uint16_t Ypos, uint16_t Xsize, uint16_t Ysize, uint8_t *pdata);
 
 /* LCD driver structure */
 extern LCD_DrvTypeDef   st7735_drv;
@@ -152,6 +154,9 @@ void     SPI_LCD_init(void);
 void     LCD_IO_Init(void);
 void     LCD_IO_WriteMultipleData(uint8_t *pData, uint32_t Size);
 void     LCD_IO_WriteReg(uint8_t Reg);
+void     LCD_IO_WritePixels(uint8_t *pData, uint32_t Size);
+void     LCD_IO_Begin(void);
+void     LCD_IO_End(void);
 void     LCD_Delay(uint32_t delay);
 /**
   * @}
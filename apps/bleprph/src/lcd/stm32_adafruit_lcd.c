@@ -55,12 +55,27 @@
        function or a complete string line using the BSP_LCD_DisplayStringAtLine() function.
      o Display a string line on the specified position (x,y in pixel) and align mode
        using the BSP_LCD_DisplayStringAtLine() function.          
+     o Characters are expanded to RGB565 once and kept in a glyph cache of
+       LCD_GLYPH_CACHE_SIZE bytes, with their colors. A string is sent in
+       a single window.
      o Draw and fill a basic shapes (dot, line, rectangle, circle, ellipse, ..) 
        on LCD using a set of functions.    
+     o Lines, circles, ellipses and polygons are gathered in horizontal spans
+       first, the spans of a row are merged and the same span on following
+       rows is sent in a single window.
+
+  + Framebuffer mode (LCD_FRAMEBUFFER)
+     o The functions above draw in a 128x128 RGB565 framebuffer in RAM, the
+       LCD only changes when BSP_LCD_Flush() is called.
+     o BSP_LCD_Flush() sends the rows drawn since the previous flush whose
+       contents did change, consecutive rows in a single window.
+     o Call BSP_LCD_Invalidate() after drawing to the LCD directly, so that
+       the next flush doesn't take the LCD for up to date.
  
 ------------------------------------------------------------------------------*/
     
 /* Includes ------------------------------------------------------------------*/
+#include "syscfg/syscfg.h"
 #include "stm32_adafruit_lcd.h"
 //#include "fonts.h" 
 
@@ -94,6 +109,23 @@
 #define MAX_HEIGHT_FONT         17
 #define MAX_WIDTH_FONT          24
 #define OFFSET_BITMAP           54
+
+/* Framebuffer rows sent to the LCD in one transfer */
+#define FB_STAGE_ROWS           4
+
+/* Glyph cache, it always holds a glyph of the biggest font */
+#define GLYPH_CACHE_SIZE        (MYNEWT_VAL(LCD_GLYPH_CACHE_SIZE) > MAX_HEIGHT_FONT*MAX_WIDTH_FONT*2 ? \
+                                 MYNEWT_VAL(LCD_GLYPH_CACHE_SIZE) : MAX_HEIGHT_FONT*MAX_WIDTH_FONT*2)
+#define GLYPH_SLOTS             32
+
+/* Spans of a shape gathered before they are sent */
+#define SPAN_MAX                128
+
+/* Same span on as many rows, sent in a window rather than line by line */
+#define SPAN_WINDOW_ROWS        3
+
+/* Row of the framebuffer not drawn since the last flush */
+#define FB_CLEAN                0xFF
 /**
   * @}
   */ 
@@ -117,6 +149,51 @@ static LCD_DrvTypeDef  *lcd_drv;
 /* Max size of bitmap will based on a font24 (17x24) */
 static uint8_t bitmap[MAX_HEIGHT_FONT*MAX_WIDTH_FONT*2+OFFSET_BITMAP] = {0};
 
+/* Horizontal run of pixels in the text color */
+typedef struct
+{
+  uint16_t X;
+  uint16_t Y;
+  uint16_t Length;
+}SpanTypeDef;
+
+static SpanTypeDef Span[SPAN_MAX];
+static uint32_t SpanCount;
+static uint32_t SpanDepth;
+
+/* Cached glyph, the slots are sized for the font of the cache */
+typedef struct
+{
+  uint32_t Age;         /* Of the last use, 0 if the slot is free */
+  uint16_t TextColor;
+  uint16_t BackColor;
+  uint8_t  Ascii;
+}GlyphTypeDef;
+
+static GlyphTypeDef Glyph[GLYPH_SLOTS];
+static sFONT *GlyphFont;
+static uint32_t GlyphSlots;
+static uint32_t GlyphClock;
+
+/* Glyphs, RGB565 high byte first, bottom row first as they are drawn */
+static uint8_t GlyphPixels[GLYPH_CACHE_SIZE];
+
+#if MYNEWT_VAL(LCD_FRAMEBUFFER)
+/* LCD memory as the bitmaps see it (MY = 0, MX = 1), row 0 at the bottom */
+static uint16_t FrameBuffer[ST7735_LCD_PIXEL_HEIGHT][ST7735_LCD_PIXEL_WIDTH];
+
+/* Columns drawn in each row since the last flush, FB_CLEAN if none */
+static uint8_t FrameFirst[ST7735_LCD_PIXEL_HEIGHT];
+static uint8_t FrameLast[ST7735_LCD_PIXEL_HEIGHT];
+
+/* Hash of each row as it was last sent, if FrameSent */
+static uint32_t FrameHash[ST7735_LCD_PIXEL_HEIGHT];
+static uint8_t  FrameSent[ST7735_LCD_PIXEL_HEIGHT];
+
+/* Pixels on their way to the LCD, high byte first */
+static uint8_t FrameStage[FB_STAGE_ROWS*ST7735_LCD_PIXEL_WIDTH*2];
+#endif
+
 /**
   * @}
   */ 
@@ -124,9 +201,45 @@ static uint8_t bitmap[MAX_HEIGHT_FONT*MAX_WIDTH_FONT*2+OFFSET_BITMAP] = {0};
 /** @defgroup STM32_ADAFRUIT_LCD_Private_FunctionPrototypes
   * @{
   */ 
-static void DrawChar(uint16_t Xpos, uint16_t Ypos, const uint8_t *c);
+static const uint8_t *GetGlyph(uint8_t Ascii);
+static void DrawString(uint16_t Xpos, uint16_t Ypos, const uint8_t *Text, uint16_t Count);
 static void FillTriangle(uint16_t x1, uint16_t x2, uint16_t x3, uint16_t y1, uint16_t y2, uint16_t y3);
 static void SetDisplayWindow(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height);
+static void FillWindow(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height);
+static void SpanBegin(void);
+static void SpanAdd(uint16_t Xpos, uint16_t Ypos, uint16_t Length);
+static void SpanEnd(void);
+#if MYNEWT_VAL(LCD_FRAMEBUFFER)
+static void FB_Init(void);
+static void FB_WritePixel(uint16_t Xpos, uint16_t Ypos, uint16_t RGBCode);
+static uint16_t FB_ReadPixel(uint16_t Xpos, uint16_t Ypos);
+static void FB_DrawHLine(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Length);
+static void FB_DrawVLine(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Length);
+static void FB_DrawBitmap(uint16_t Xpos, uint16_t Ypos, uint8_t *pbmp);
+static void FB_DrawRGBImage(uint16_t Xpos, uint16_t Ypos, uint16_t Xsize, uint16_t Ysize, uint8_t *pdata);
+static void FB_FillWindow(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height);
+static void FB_SendRows(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height);
+
+/* Driver drawing in the framebuffer, the window functions are not needed */
+static LCD_DrvTypeDef FrameBuffer_drv =
+{
+  FB_Init,
+  0,
+  st7735_DisplayOn,
+  st7735_DisplayOff,
+  0,
+  FB_WritePixel,
+  FB_ReadPixel,
+  0,
+  FB_DrawHLine,
+  FB_DrawVLine,
+  st7735_GetLcdPixelWidth,
+  st7735_GetLcdPixelHeight,
+  FB_DrawBitmap,
+  FB_DrawRGBImage,
+  FB_FillWindow,
+};
+#endif
 /**
   * @}
   */ 
@@ -150,13 +263,18 @@ uint8_t BSP_LCD_Init(void)
   DrawProp.pFont     = &Font24;
   DrawProp.TextColor = 0x0000;
   
+#if MYNEWT_VAL(LCD_FRAMEBUFFER)
+  lcd_drv = &FrameBuffer_drv;
+#else
   lcd_drv = &st7735_drv;
+#endif
   
   /* LCD Init */   
   lcd_drv->Init();
   
   /* Clear the LCD screen */
   BSP_LCD_Clear(LCD_COLOR_WHITE);
+  BSP_LCD_Flush();
   
   /* Initialize the font */
   BSP_LCD_SetFont(&LCD_DEFAULT_FONT);
@@ -253,15 +371,10 @@ sFONT *BSP_LCD_GetFont(void)
   */
 void BSP_LCD_Clear(uint16_t Color)
 { 
-  uint32_t counter = 0;
   uint32_t color_backup = DrawProp.TextColor; 
   DrawProp.TextColor = Color;
   
-  for(counter = 0; counter < BSP_LCD_GetYSize(); counter++)
-  {
-	//HAL_Delay(2);
-    BSP_LCD_DrawHLine(0, counter, BSP_LCD_GetXSize());
-  }
+  FillWindow(0, 0, BSP_LCD_GetXSize(), BSP_LCD_GetYSize());
   DrawProp.TextColor = color_backup; 
   BSP_LCD_SetTextColor(DrawProp.TextColor);
 }
@@ -297,8 +410,7 @@ void BSP_LCD_ClearStringLine(uint16_t Line)
   */
 void BSP_LCD_DisplayChar(uint16_t Xpos, uint16_t Ypos, uint8_t Ascii)
 {
-  DrawChar(Xpos, Ypos, &DrawProp.pFont->table[(Ascii-' ') *\
-    DrawProp.pFont->Height * ((DrawProp.pFont->Width + 7) / 8)]);
+  DrawString(Xpos, Ypos, &Ascii, 1);
 }
 
 /**
@@ -349,6 +461,21 @@ void BSP_LCD_DisplayStringAt(uint16_t Xpos, uint16_t Ypos, uint8_t *Text, Line_M
     }
   }
   
+  /* Number of characters sent */
+  while ((Text[i] != 0) & (((BSP_LCD_GetXSize() - (i*DrawProp.pFont->Width)) & 0xFFFF) >= DrawProp.pFont->Width))
+  {
+    i++;
+  }
+  
+  /* All in a single window when the string is in the LCD */
+  if((i > 0) && (refcolumn + i*DrawProp.pFont->Width <= BSP_LCD_GetXSize()) &&
+     (Ypos + DrawProp.pFont->Height <= BSP_LCD_GetYSize()))
+  {
+    DrawString(refcolumn, Ypos, Text, i);
+    return;
+  }
+  i = 0;
+  
   /* Send the string character by character on lCD */
   while ((*Text != 0) & (((BSP_LCD_GetXSize() - (i*DrawProp.pFont->Width)) & 0xFFFF) >= DrawProp.pFont->Width))
   {
@@ -503,9 +630,10 @@ void BSP_LCD_DrawLine(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
     numpixels = deltay;         /* There are more y-values than x-values */
   }
   
+  SpanBegin();
   for (curpixel = 0; curpixel <= numpixels; curpixel++)
   {
-    BSP_LCD_DrawPixel(x, y, DrawProp.TextColor);  /* Draw the current pixel */
+    SpanAdd(x, y, 1);                         /* Draw the current pixel */
     num += numadd;                            /* Increase the numerator by the top of the fraction */
     if (num >= den)                           /* Check if numerator >= denominator */
     {
@@ -516,6 +644,7 @@ void BSP_LCD_DrawLine(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
     x += xinc2;                               /* Change the x as appropriate */
     y += yinc2;                               /* Change the y as appropriate */
   }
+  SpanEnd();
 }
 
 /**
@@ -554,26 +683,24 @@ void BSP_LCD_DrawCircle(uint16_t Xpos, uint16_t Ypos, uint16_t Radius)
   CurX = 0;
   CurY = Radius;
   
+  SpanBegin();
   while (CurX <= CurY)
   {
-    BSP_LCD_DrawPixel((Xpos + CurX), (Ypos - CurY), DrawProp.TextColor);
-
-    BSP_LCD_DrawPixel((Xpos - CurX), (Ypos - CurY), DrawProp.TextColor);
+    SpanAdd((Xpos + CurX), (Ypos - CurY), 1);
 
-    BSP_LCD_DrawPixel((Xpos + CurY), (Ypos - CurX), DrawProp.TextColor);
+    SpanAdd((Xpos - CurX), (Ypos - CurY), 1);
 
-    BSP_LCD_DrawPixel((Xpos - CurY), (Ypos - CurX), DrawProp.TextColor);
+    SpanAdd((Xpos + CurY), (Ypos - CurX), 1);
 
-    BSP_LCD_DrawPixel((Xpos + CurX), (Ypos + CurY), DrawProp.TextColor);
+    SpanAdd((Xpos - CurY), (Ypos - CurX), 1);
 
-    BSP_LCD_DrawPixel((Xpos - CurX), (Ypos + CurY), DrawProp.TextColor);
+    SpanAdd((Xpos + CurX), (Ypos + CurY), 1);
 
-    BSP_LCD_DrawPixel((Xpos + CurY), (Ypos + CurX), DrawProp.TextColor);
+    SpanAdd((Xpos - CurX), (Ypos + CurY), 1);
 
-    BSP_LCD_DrawPixel((Xpos - CurY), (Ypos + CurX), DrawProp.TextColor);   
+    SpanAdd((Xpos + CurY), (Ypos + CurX), 1);
 
-    /* Initialize the font */
-    BSP_LCD_SetFont(&LCD_DEFAULT_FONT);
+    SpanAdd((Xpos - CurY), (Ypos + CurX), 1);
 
     if (D < 0)
     { 
@@ -586,6 +713,7 @@ void BSP_LCD_DrawCircle(uint16_t Xpos, uint16_t Ypos, uint16_t Radius)
     }
     CurX++;
   } 
+  SpanEnd();
 }
 
 /**
@@ -603,6 +731,7 @@ void BSP_LCD_DrawPolygon(pPoint Points, uint16_t PointCount)
     return;
   }
 
+  SpanBegin();
   BSP_LCD_DrawLine(Points->X, Points->Y, (Points+PointCount-1)->X, (Points+PointCount-1)->Y);
   
   while(--PointCount)
@@ -612,6 +741,7 @@ void BSP_LCD_DrawPolygon(pPoint Points, uint16_t PointCount)
     Points++;
     BSP_LCD_DrawLine(X, Y, Points->X, Points->Y);
   }
+  SpanEnd();
 }
 
 /**
@@ -632,11 +762,12 @@ void BSP_LCD_DrawEllipse(int Xpos, int Ypos, int XRadius, int YRadius)
   
   K = (float)(rad2/rad1);
   
+  SpanBegin();
   do {      
-    BSP_LCD_DrawPixel((Xpos-(uint16_t)(x/K)), (Ypos+y), DrawProp.TextColor);
-    BSP_LCD_DrawPixel((Xpos+(uint16_t)(x/K)), (Ypos+y), DrawProp.TextColor);
-    BSP_LCD_DrawPixel((Xpos+(uint16_t)(x/K)), (Ypos-y), DrawProp.TextColor);
-    BSP_LCD_DrawPixel((Xpos-(uint16_t)(x/K)), (Ypos-y), DrawProp.TextColor);      
+    SpanAdd((Xpos-(uint16_t)(x/K)), (Ypos+y), 1);
+    SpanAdd((Xpos+(uint16_t)(x/K)), (Ypos+y), 1);
+    SpanAdd((Xpos+(uint16_t)(x/K)), (Ypos-y), 1);
+    SpanAdd((Xpos-(uint16_t)(x/K)), (Ypos-y), 1);
     
     e2 = err;
     if (e2 <= x) {
@@ -646,6 +777,7 @@ void BSP_LCD_DrawEllipse(int Xpos, int Ypos, int XRadius, int YRadius)
     if (e2 > y) err += ++y*2+1;     
   }
   while (y <= 0);
+  SpanEnd();
 }
 
 /**
@@ -669,11 +801,16 @@ void BSP_LCD_DrawBitmap(uint16_t Xpos, uint16_t Ypos, uint8_t *pBmp)
   
   /* Remap Ypos, st7735 works with inverted X in case of bitmap */
   /* X = 0, cursor is on Top corner */
+#if MYNEWT_VAL(LCD_FRAMEBUFFER)
+  if(lcd_drv == &st7735_drv || lcd_drv == &FrameBuffer_drv)
+#else
   if(lcd_drv == &st7735_drv)
+#endif
   {
     Ypos = BSP_LCD_GetYSize() - Ypos - height;
   }
   
+  LCD_IO_Begin();
   SetDisplayWindow(Xpos, Ypos, width, height);
   
   if(lcd_drv->DrawBitmap != NULL)
@@ -681,6 +818,7 @@ void BSP_LCD_DrawBitmap(uint16_t Xpos, uint16_t Ypos, uint8_t *pBmp)
     lcd_drv->DrawBitmap(Xpos, Ypos, pBmp);
   } 
   SetDisplayWindow(0, 0, BSP_LCD_GetXSize(), BSP_LCD_GetYSize());
+  LCD_IO_End();
 }
 
 /**
@@ -694,6 +832,14 @@ void BSP_LCD_DrawBitmap(uint16_t Xpos, uint16_t Ypos, uint8_t *pBmp)
 void BSP_LCD_FillRect(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height)
 {
   BSP_LCD_SetTextColor(DrawProp.TextColor);
+  
+  /* Height + 1 lines, in a window when they are all in the LCD */
+  if((Width > 0) && (Xpos + Width <= BSP_LCD_GetXSize()) && (Ypos + Height < BSP_LCD_GetYSize()))
+  {
+    FillWindow(Xpos, Ypos, Width, Height + 1);
+    return;
+  }
+  
   do
   {
     BSP_LCD_DrawHLine(Xpos, Ypos++, Width);    
@@ -721,18 +867,19 @@ void BSP_LCD_FillCircle(uint16_t Xpos, uint16_t Ypos, uint16_t Radius)
   
   BSP_LCD_SetTextColor(DrawProp.TextColor);
 
+  SpanBegin();
   while (CurX <= CurY)
   {
     if(CurY > 0) 
     {
-      BSP_LCD_DrawHLine(Xpos - CurY, Ypos + CurX, 2*CurY);
-      BSP_LCD_DrawHLine(Xpos - CurY, Ypos - CurX, 2*CurY);
+      SpanAdd(Xpos - CurY, Ypos + CurX, 2*CurY);
+      SpanAdd(Xpos - CurY, Ypos - CurX, 2*CurY);
     }
 
     if(CurX > 0) 
     {
-      BSP_LCD_DrawHLine(Xpos - CurX, Ypos - CurY, 2*CurX);
-      BSP_LCD_DrawHLine(Xpos - CurX, Ypos + CurY, 2*CurX);
+      SpanAdd(Xpos - CurX, Ypos - CurY, 2*CurX);
+      SpanAdd(Xpos - CurX, Ypos + CurY, 2*CurX);
     }
     if (D < 0)
     { 
@@ -748,6 +895,7 @@ void BSP_LCD_FillCircle(uint16_t Xpos, uint16_t Ypos, uint16_t Radius)
 
   BSP_LCD_SetTextColor(DrawProp.TextColor);
   BSP_LCD_DrawCircle(Xpos, Ypos, Radius);
+  SpanEnd();
 }
 
 /**
@@ -798,6 +946,7 @@ void BSP_LCD_FillPolygon(pPoint Points, uint16_t PointCount)
   X_first = Points->X;
   Y_first = Points->Y;
   
+  SpanBegin();
   while(--PointCount)
   {
     X = Points->X;
@@ -814,6 +963,7 @@ void BSP_LCD_FillPolygon(pPoint Points, uint16_t PointCount)
   FillTriangle(X_first, X2, X_center, Y_first, Y2, Y_center);
   FillTriangle(X_first, X_center, X2, Y_first, Y_center, Y2);
   FillTriangle(X_center, X2, X_first, Y_center, Y2, Y_first);   
+  SpanEnd();
 }
 
 /**
@@ -834,10 +984,11 @@ void BSP_LCD_FillEllipse(int Xpos, int Ypos, int XRadius, int YRadius)
   
   K = (float)(rad2/rad1);    
   
+  SpanBegin();
   do 
   { 
-    BSP_LCD_DrawHLine((Xpos-(uint16_t)(x/K)), (Ypos+y), (2*(uint16_t)(x/K) + 1));
-    BSP_LCD_DrawHLine((Xpos-(uint16_t)(x/K)), (Ypos-y), (2*(uint16_t)(x/K) + 1));
+    SpanAdd((Xpos-(uint16_t)(x/K)), (Ypos+y), (2*(uint16_t)(x/K) + 1));
+    SpanAdd((Xpos-(uint16_t)(x/K)), (Ypos-y), (2*(uint16_t)(x/K) + 1));
     
     e2 = err;
     if (e2 <= x) 
@@ -848,6 +999,7 @@ void BSP_LCD_FillEllipse(int Xpos, int Ypos, int XRadius, int YRadius)
     if (e2 > y) err += ++y*2+1;
   }
   while (y <= 0);
+  SpanEnd();
 }
 
 /**
@@ -870,77 +1022,233 @@ void BSP_LCD_DisplayOff(void)
   lcd_drv->DisplayOff();
 }
 
+/**
+  * @brief  Sends what was drawn in the framebuffer since the last flush.
+  *         Rows drawn again as they were are not sent.
+  * @param  None
+  * @retval None
+  */
+void BSP_LCD_Flush(void)
+{
+#if MYNEWT_VAL(LCD_FRAMEBUFFER)
+  uint16_t row = 0, first = 0, last = 0, start = 0, x1 = 0, x2 = 0;
+  uint8_t send = 0, run = 0, sent = 0;
+  uint32_t hash = 0, col = 0;
+  
+  /* All the windows under one chip select */
+  LCD_IO_Begin();
+  
+  for(row = 0; row <= ST7735_LCD_PIXEL_HEIGHT; row++)
+  {
+    send = 0;
+    if(row < ST7735_LCD_PIXEL_HEIGHT && FrameFirst[row] != FB_CLEAN)
+    {
+      /* Taken before hashing, a row drawn meanwhile is sent next time */
+      first = FrameFirst[row];
+      last = FrameLast[row];
+      FrameFirst[row] = FB_CLEAN;
+      
+      /* FNV-1a over the whole row */
+      hash = 2166136261u;
+      for(col = 0; col < ST7735_LCD_PIXEL_WIDTH; col++)
+      {
+        hash = (hash ^ FrameBuffer[row][col]) * 16777619u;
+      }
+      if(!FrameSent[row] || FrameHash[row] != hash)
+      {
+        FrameHash[row] = hash;
+        FrameSent[row] = 1;
+        send = 1;
+      }
+    }
+    
+    /* Rows whose columns overlap go in the same window */
+    if(run && send && first <= x2 && last >= x1)
+    {
+      x1 = first < x1 ? first : x1;
+      x2 = last > x2 ? last : x2;
+      continue;
+    }
+    if(run)
+    {
+      if(!sent)
+      {
+        /* Memory access control: MY = 0, MX = 1, MV = 0, ML = 0 */
+        st7735_WriteReg(LCD_REG_54, 0x48);
+        sent = 1;
+      }
+      FB_SendRows(x1, start, x2 - x1 + 1, row - start);
+      run = 0;
+    }
+    if(send)
+    {
+      run = 1;
+      start = row;
+      x1 = first;
+      x2 = last;
+    }
+  }
+  
+  if(sent)
+  {
+    st7735_SetDisplayWindow(0, 0, ST7735_LCD_PIXEL_WIDTH, ST7735_LCD_PIXEL_HEIGHT);
+  }
+  
+  LCD_IO_End();
+#endif
+}
+
+/**
+  * @brief  Forgets what the LCD shows, to be called once it was drawn
+  *         without the framebuffer. Drawn rows are then always sent.
+  * @param  None
+  * @retval None
+  */
+void BSP_LCD_Invalidate(void)
+{
+#if MYNEWT_VAL(LCD_FRAMEBUFFER)
+  uint32_t row = 0;
+  
+  for(row = 0; row < ST7735_LCD_PIXEL_HEIGHT; row++)
+  {
+    FrameSent[row] = 0;
+  }
+#endif
+}
+
 /*******************************************************************************
                             Static Functions
 *******************************************************************************/
 
 /**
-  * @brief  Draws a character on LCD.
-  * @param  Xpos: Line where to display the character shape
-  * @param  Ypos: Start column address
-  * @param  pChar: Pointer to the character data
-  * @retval None
+  * @brief  Gets a character expanded with the colors in use, from the
+  *         glyph cache or the font. A new font empties the cache.
+  * @param  Ascii: Character ascii code
+  * @retval Pixels of the character, valid until the next call
   */
-static void DrawChar(uint16_t Xpos, uint16_t Ypos, const uint8_t *pChar)
+static const uint8_t *GetGlyph(uint8_t Ascii)
 {
-  uint32_t counterh = 0, counterw = 0, index = 0;
+  uint32_t counterh = 0, counterw = 0, index = 0, slot = 0, size = 0;
   uint16_t height = 0, width = 0;
   uint8_t offset = 0;
-  uint8_t *pchar = NULL;
+  const uint8_t *pchar = NULL;
+  uint8_t *pglyph = NULL;
   uint32_t line = 0;
+  uint16_t color = 0;
   
   height = DrawProp.pFont->Height;
   width  = DrawProp.pFont->Width;
+  size = height*width*2;
+  
+  if(GlyphFont != DrawProp.pFont)
+  {
+    GlyphFont = DrawProp.pFont;
+    GlyphSlots = GLYPH_CACHE_SIZE / size > GLYPH_SLOTS ? GLYPH_SLOTS : GLYPH_CACHE_SIZE / size;
+    for(slot = 0; slot < GLYPH_SLOTS; slot++)
+    {
+      Glyph[slot].Age = 0;
+    }
+  }
+  
+  /* Cached, or the slot used the longest time ago */
+  GlyphClock++;
+  index = 0;
+  for(slot = 0; slot < GlyphSlots; slot++)
+  {
+    if(Glyph[slot].Age && Glyph[slot].Ascii == Ascii &&
+       Glyph[slot].TextColor == (uint16_t)DrawProp.TextColor &&
+       Glyph[slot].BackColor == (uint16_t)DrawProp.BackColor)
+    {
+      Glyph[slot].Age = GlyphClock;
+      return &GlyphPixels[slot*size];
+    }
+    if(Glyph[slot].Age < Glyph[index].Age)
+    {
+      index = slot;
+    }
+  }
   
-  /* Fill bitmap header*/
-  *(uint16_t *) (bitmap + 2) = (uint16_t)(height*width*2+OFFSET_BITMAP);
-  *(uint16_t *) (bitmap + 4) = (uint16_t)((height*width*2+OFFSET_BITMAP)>>16);
-  *(uint16_t *) (bitmap + 10) = OFFSET_BITMAP;
-  *(uint16_t *) (bitmap + 18) = (uint16_t)(width);
-  *(uint16_t *) (bitmap + 20) = (uint16_t)((width)>>16);
-  *(uint16_t *) (bitmap + 22) = (uint16_t)(height);
-  *(uint16_t *) (bitmap + 24) = (uint16_t)((height)>>16);
+  slot = index;
+  Glyph[slot].Age = GlyphClock;
+  Glyph[slot].Ascii = Ascii;
+  Glyph[slot].TextColor = DrawProp.TextColor;
+  Glyph[slot].BackColor = DrawProp.BackColor;
+  pglyph = &GlyphPixels[slot*size];
   
   offset =  8 *((width + 7)/8) - width ;
+  pchar = &DrawProp.pFont->table[(Ascii-' ') * height * ((width + 7)/8)];
   
-  for(counterh = 0; counterh < height; counterh++)
+  for(counterh = 0; counterh < height; counterh++, pchar += (width + 7)/8)
   {
-    pchar = ((uint8_t *)pChar + (width + 7)/8 * counterh);
-    
-    if(((width + 7)/8) == 3)
+    line = 0;
+    for(counterw = 0; counterw < (width + 7)/8; counterw++)
     {
-      line =  (pchar[0]<< 16) | (pchar[1]<< 8) | pchar[2];
+      line = (line << 8) | pchar[counterw];
     }
     
-    if(((width + 7)/8) == 2)
+    for (counterw = 0; counterw < width; counterw++)
     {
-      line =  (pchar[0]<< 8) | pchar[1];
+      /* The font is stored from the top to the bottom */
+      index = (((height-counterh-1)*width)+(counterw))*2;
+      color = (line & (1 << (width- counterw + offset- 1))) ? DrawProp.TextColor : DrawProp.BackColor;
+      pglyph[index] = (uint8_t)(color >> 8);
+      pglyph[index+1] = (uint8_t)color;
     }
+  }
+  
+  return pglyph;
+}
+
+/**
+  * @brief  Draws characters next to each other in a single window, sent
+  *         a band of rows of the bitmap buffer at a time.
+  * @param  Xpos: Start column address
+  * @param  Ypos: Line where to display the characters
+  * @param  Text: Characters to display
+  * @param  Count: Number of characters, they must all fit in the LCD
+  * @retval None
+  */
+static void DrawString(uint16_t Xpos, uint16_t Ypos, const uint8_t *Text, uint16_t Count)
+{
+  uint32_t row = 0, rows = 0, band = 0, counter = 0, counterh = 0, index = 0;
+  uint16_t height = 0, width = 0;
+  const uint8_t *pglyph = NULL;
+  
+  height = DrawProp.pFont->Height;
+  width  = DrawProp.pFont->Width;
+  
+  /* Remap Ypos, st7735 works with inverted X in case of bitmap */
+  Ypos = BSP_LCD_GetYSize() - Ypos - height;
+  
+  LCD_IO_Begin();
+  SetDisplayWindow(Xpos, Ypos, Count*width, height);
+  
+  band = sizeof(bitmap) / (Count*width*2);
+  for(row = 0; row < height; row += band)
+  {
+    rows = height - row < band ? height - row : band;
     
-    if(((width + 7)/8) == 1)
-    {
-      line =  pchar[0];
-    }    
-    
-    for (counterw = 0; counterw < width; counterw++)
+    /* Rows of every character, looked up once per band */
+    for(counter = 0; counter < Count; counter++)
     {
-      /* Image in the bitmap is written from the bottom to the top */
-      /* Need to invert image in the bitmap */
-      index = (((height-counterh-1)*width)+(counterw))*2+OFFSET_BITMAP;
-      if(line & (1 << (width- counterw + offset- 1))) 
+      pglyph = GetGlyph(Text[counter]) + row*width*2;
+      for(counterh = 0; counterh < rows; counterh++)
       {
-        bitmap[index] = (uint8_t)DrawProp.TextColor;
-        bitmap[index+1] = (uint8_t)(DrawProp.TextColor >> 8);
+        for(index = 0; index < width*2u; index++)
+        {
+          bitmap[(counterh*Count + counter)*width*2 + index] = pglyph[counterh*width*2 + index];
+        }
       }
-      else
-      {
-        bitmap[index] = (uint8_t)DrawProp.BackColor;
-        bitmap[index+1] = (uint8_t)(DrawProp.BackColor >> 8);
-      } 
+    }
+    
+    if(lcd_drv->DrawRGBImage != NULL)
+    {
+      lcd_drv->DrawRGBImage(Xpos, Ypos + row, Count*width, rows, bitmap);
     }
   }
   
-  BSP_LCD_DrawBitmap(Xpos, Ypos, bitmap);
+  SetDisplayWindow(0, 0, BSP_LCD_GetXSize(), BSP_LCD_GetYSize());
+  LCD_IO_End();
 }
 
 /**
@@ -1006,6 +1314,7 @@ static void FillTriangle(uint16_t x1, uint16_t x2, uint16_t x3, uint16_t y1, uin
     numpixels = deltay;         /* There are more y-values than x-values */
   }
   
+  SpanBegin();
   for (curpixel = 0; curpixel <= numpixels; curpixel++)
   {
     BSP_LCD_DrawLine(x, y, x3, y3);
@@ -1020,8 +1329,275 @@ static void FillTriangle(uint16_t x1, uint16_t x2, uint16_t x3, uint16_t y1, uin
     x += xinc2;                 /* Change the x as appropriate */
     y += yinc2;                 /* Change the y as appropriate */
   } 
+  SpanEnd();
+}
+
+#if MYNEWT_VAL(LCD_FRAMEBUFFER)
+/**
+  * @brief  Initializes the LCD, nothing is drawn in the framebuffer yet.
+  * @param  None
+  * @retval None
+  */
+static void FB_Init(void)
+{
+  uint32_t row = 0;
+  
+  st7735_Init();
+  
+  for(row = 0; row < ST7735_LCD_PIXEL_HEIGHT; row++)
+  {
+    FrameFirst[row] = FB_CLEAN;
+    FrameSent[row] = 0;
+  }
+}
+
+/**
+  * @brief  Marks columns of a row of the framebuffer as drawn.
+  * @param  Xpos: first column
+  * @param  Ypos: row
+  * @param  Length: number of columns
+  * @retval None
+  */
+static void FB_Touch(uint16_t Xpos, uint16_t Ypos, uint16_t Length)
+{
+  if(FrameFirst[Ypos] == FB_CLEAN)
+  {
+    FrameFirst[Ypos] = Xpos;
+    FrameLast[Ypos] = Xpos + Length - 1;
+    return;
+  }
+  if(Xpos < FrameFirst[Ypos])
+  {
+    FrameFirst[Ypos] = Xpos;
+  }
+  if(Xpos + Length - 1 > FrameLast[Ypos])
+  {
+    FrameLast[Ypos] = Xpos + Length - 1;
+  }
+}
+
+/**
+  * @brief  Draws a span in the framebuffer.
+  * @param  RGBCode: the RGB pixel color
+  * @param  Xpos: first column
+  * @param  Ypos: row
+  * @param  Length: span length
+  * @retval None
+  */
+static void FB_Span(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Length)
+{
+  uint16_t *pixel = &FrameBuffer[Ypos][Xpos];
+  uint32_t counter = 0;
+  
+  for(counter = 0; counter < Length; counter++)
+  {
+    pixel[counter] = RGBCode;
+  }
+  FB_Touch(Xpos, Ypos, Length);
+}
+
+/**
+  * @brief  Writes a pixel in the framebuffer, st7735_WritePixel().
+  * @param  Xpos: specifies the X position.
+  * @param  Ypos: specifies the Y position.
+  * @param  RGBCode: the RGB pixel color
+  * @retval None
+  */
+static void FB_WritePixel(uint16_t Xpos, uint16_t Ypos, uint16_t RGBCode)
+{
+  if((Xpos >= ST7735_LCD_PIXEL_WIDTH) || (Ypos >= ST7735_LCD_PIXEL_HEIGHT))
+  {
+    return;
+  }
+  FB_Span(RGBCode, Xpos, Ypos, 1);
+}
+
+/**
+  * @brief  Reads a pixel of the framebuffer.
+  * @param  Xpos: specifies the X position.
+  * @param  Ypos: specifies the Y position.
+  * @retval The RGB pixel color
+  */
+static uint16_t FB_ReadPixel(uint16_t Xpos, uint16_t Ypos)
+{
+  if((Xpos >= ST7735_LCD_PIXEL_WIDTH) || (Ypos >= ST7735_LCD_PIXEL_HEIGHT))
+  {
+    return 0;
+  }
+  return FrameBuffer[Ypos][Xpos];
+}
+
+/**
+  * @brief  Draws an horizontal line in the framebuffer, st7735_DrawHLine().
+  * @param  RGBCode: Specifies the RGB color
+  * @param  Xpos: specifies the X position.
+  * @param  Ypos: specifies the Y position.
+  * @param  Length: specifies the line length.
+  * @retval None
+  */
+static void FB_DrawHLine(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Length)
+{
+  if((Xpos + Length > ST7735_LCD_PIXEL_WIDTH) || (Ypos >= ST7735_LCD_PIXEL_HEIGHT) || (Length == 0))
+  {
+    return;
+  }
+  FB_Span(RGBCode, Xpos, Ypos, Length);
 }
 
+/**
+  * @brief  Draws a vertical line in the framebuffer, st7735_DrawVLine().
+  * @param  RGBCode: Specifies the RGB color
+  * @param  Xpos: specifies the X position.
+  * @param  Ypos: specifies the Y position.
+  * @param  Length: specifies the line length.
+  * @retval None
+  */
+static void FB_DrawVLine(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Length)
+{
+  if(Ypos + Length > ST7735_LCD_PIXEL_HEIGHT) return;
+  FB_FillWindow(RGBCode, Xpos, Ypos, 1, Length);
+}
+
+/**
+  * @brief  Draws a bitmap in the framebuffer, st7735_DrawBitmap(): its
+  *         window starts at Xpos, Ypos.
+  * @param  Xpos: Bmp X position
+  * @param  Ypos: Bmp Y position, remapped
+  * @param  pbmp: Pointer to Bmp picture address
+  * @retval None
+  */
+static void FB_DrawBitmap(uint16_t Xpos, uint16_t Ypos, uint8_t *pbmp)
+{
+  uint32_t index = 0, width = 0, height = 0, counterh = 0, counterw = 0, len = 0;
+  uint8_t *pixel = NULL;
+  
+  width = *(uint16_t *) (pbmp + 18);
+  width |= (*(uint16_t *) (pbmp + 20)) << 16;
+  height = *(uint16_t *) (pbmp + 22);
+  height |= (*(uint16_t *) (pbmp + 24)) << 16;
+  index = *(uint16_t *) (pbmp + 10);
+  index |= (*(uint16_t *) (pbmp + 12)) << 16;
+  
+  if((Xpos >= ST7735_LCD_PIXEL_WIDTH) || (width == 0))
+  {
+    return;
+  }
+  len = Xpos + width > ST7735_LCD_PIXEL_WIDTH ? ST7735_LCD_PIXEL_WIDTH - Xpos : width;
+  
+  for(counterh = 0; counterh < height; counterh++)
+  {
+    if(Ypos + counterh >= ST7735_LCD_PIXEL_HEIGHT)
+    {
+      continue;
+    }
+    /* Pixels are stored low byte first */
+    pixel = pbmp + index + counterh * width * 2;
+    for(counterw = 0; counterw < len; counterw++)
+    {
+      FrameBuffer[Ypos + counterh][Xpos + counterw] = pixel[2*counterw] | (pixel[2*counterw + 1] << 8);
+    }
+    FB_Touch(Xpos, Ypos + counterh, len);
+  }
+}
+
+/**
+  * @brief  Draws RGB565 pixels in the framebuffer, st7735_DrawRGBImage().
+  * @param  Xpos: specifies the X position.
+  * @param  Ypos: specifies the Y position.
+  * @param  Xsize: width of the image.
+  * @param  Ysize: height of the image.
+  * @param  pdata: pixels, high byte first.
+  * @retval None
+  */
+static void FB_DrawRGBImage(uint16_t Xpos, uint16_t Ypos, uint16_t Xsize, uint16_t Ysize, uint8_t *pdata)
+{
+  uint32_t counterh = 0, counterw = 0, len = 0;
+  uint8_t *pixel = NULL;
+  
+  if((Xpos >= ST7735_LCD_PIXEL_WIDTH) || (Xsize == 0))
+  {
+    return;
+  }
+  len = Xpos + Xsize > ST7735_LCD_PIXEL_WIDTH ? ST7735_LCD_PIXEL_WIDTH - Xpos : Xsize;
+  
+  for(counterh = 0; counterh < Ysize; counterh++)
+  {
+    if(Ypos + counterh >= ST7735_LCD_PIXEL_HEIGHT)
+    {
+      continue;
+    }
+    pixel = pdata + counterh * Xsize * 2;
+    for(counterw = 0; counterw < len; counterw++)
+    {
+      FrameBuffer[Ypos + counterh][Xpos + counterw] = (pixel[2*counterw] << 8) | pixel[2*counterw + 1];
+    }
+    FB_Touch(Xpos, Ypos + counterh, len);
+  }
+}
+
+/**
+  * @brief  Fills a window of the framebuffer, st7735_FillWindow().
+  * @param  RGBCode: Specifies the RGB color
+  * @param  Xpos: specifies the X position.
+  * @param  Ypos: specifies the Y position.
+  * @param  Width: window width.
+  * @param  Height: window height.
+  * @retval None
+  */
+static void FB_FillWindow(uint16_t RGBCode, uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height)
+{
+  uint32_t counterh = 0;
+  
+  if((Xpos >= ST7735_LCD_PIXEL_WIDTH) || (Width == 0))
+  {
+    return;
+  }
+  if(Xpos + Width > ST7735_LCD_PIXEL_WIDTH)
+  {
+    Width = ST7735_LCD_PIXEL_WIDTH - Xpos;
+  }
+  
+  for(counterh = 0; counterh < Height && Ypos + counterh < ST7735_LCD_PIXEL_HEIGHT; counterh++)
+  {
+    FB_Span(RGBCode, Xpos, Ypos + counterh, Width);
+  }
+}
+
+/**
+  * @brief  Sends a window of the framebuffer, FB_STAGE_ROWS at a time.
+  * @param  Xpos: first column
+  * @param  Ypos: first row
+  * @param  Width: window width
+  * @param  Height: window height
+  * @retval None
+  */
+static void FB_SendRows(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height)
+{
+  uint32_t row = 0, col = 0, len = 0;
+  
+  st7735_SetDisplayWindow(Xpos, Ypos, Width, Height);
+  LCD_IO_WriteReg(LCD_REG_44);
+  
+  for(row = Ypos; row < Ypos + Height; row++)
+  {
+    if(len + Width * 2 > sizeof(FrameStage))
+    {
+      LCD_IO_WritePixels(FrameStage, len);
+      len = 0;
+    }
+    for(col = Xpos; col < Xpos + Width; col++)
+    {
+      FrameStage[len++] = FrameBuffer[row][col] >> 8;
+      FrameStage[len++] = FrameBuffer[row][col];
+    }
+  }
+  if(len)
+  {
+    LCD_IO_WritePixels(FrameStage, len);
+  }
+}
+#endif
+
 /**
   * @brief  Sets display window.
   * @param  LayerIndex: layer index
@@ -1039,6 +1615,203 @@ static void SetDisplayWindow(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint1
   }  
 }
 
+/**
+  * @brief  Fills a window with the text color.
+  * @param  Xpos: LCD X position
+  * @param  Ypos: LCD Y position
+  * @param  Width: LCD window width
+  * @param  Height: LCD window height  
+  * @retval None
+  */
+static void FillWindow(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height)
+{
+  uint32_t counter = 0;
+  
+  if(lcd_drv->FillWindow != NULL)
+  {
+    lcd_drv->FillWindow(DrawProp.TextColor, Xpos, Ypos, Width, Height);
+    return;
+  }
+  for(counter = 0; counter < Height; counter++)
+  {
+    BSP_LCD_DrawHLine(Xpos, Ypos + counter, Width);
+  }
+}
+
+/**
+  * @brief  Starts a shape: its spans are sent once it ends, or when there
+  *         is no room left for them. Shapes made of shapes nest.
+  * @param  None
+  * @retval None
+  */
+static void SpanBegin(void)
+{
+  SpanDepth++;
+}
+
+/**
+  * @brief  Whether span a goes before span b: by row then column, or by
+  *         column, length then row.
+  * @param  a: First span
+  * @param  b: Second span
+  * @param  ByColumn: Order to sort in
+  * @retval 1 if a goes first
+  */
+static uint8_t SpanBefore(const SpanTypeDef *a, const SpanTypeDef *b, uint8_t ByColumn)
+{
+  if(ByColumn)
+  {
+    if(a->X != b->X) return a->X < b->X;
+    if(a->Length != b->Length) return a->Length < b->Length;
+    return a->Y < b->Y;
+  }
+  if(a->Y != b->Y) return a->Y < b->Y;
+  return a->X < b->X;
+}
+
+/**
+  * @brief  Sorts the spans, there are few of them.
+  * @param  ByColumn: Order to sort in, see SpanBefore()
+  * @retval None
+  */
+static void SpanSort(uint8_t ByColumn)
+{
+  uint32_t counter = 0, index = 0;
+  SpanTypeDef span;
+  
+  for(counter = 1; counter < SpanCount; counter++)
+  {
+    span = Span[counter];
+    for(index = counter; index > 0 && SpanBefore(&span, &Span[index - 1], ByColumn); index--)
+    {
+      Span[index] = Span[index - 1];
+    }
+    Span[index] = span;
+  }
+}
+
+/**
+  * @brief  Sends the spans gathered. The spans of a row that touch are
+  *         merged, the same span on SPAN_WINDOW_ROWS rows or more is sent
+  *         in a window, the others line by line.
+  * @param  None
+  * @retval None
+  */
+static void SpanFlush(void)
+{
+  uint32_t counter = 0, index = 0, rows = 0;
+  
+  SpanSort(0);
+  for(counter = 1, index = 0; counter < SpanCount; counter++)
+  {
+    if(Span[counter].Y == Span[index].Y &&
+       Span[counter].X <= Span[index].X + Span[index].Length)
+    {
+      if(Span[counter].X + Span[counter].Length > Span[index].X + Span[index].Length)
+      {
+        Span[index].Length = Span[counter].X + Span[counter].Length - Span[index].X;
+      }
+      continue;
+    }
+    Span[++index] = Span[counter];
+  }
+  if(SpanCount > 0)
+  {
+    SpanCount = index + 1;
+  }
+  
+  /* All the lines and windows under one chip select */
+  LCD_IO_Begin();
+  
+  SpanSort(1);
+  for(counter = 0; counter < SpanCount; counter += rows)
+  {
+    for(rows = 1; counter + rows < SpanCount; rows++)
+    {
+      if(Span[counter + rows].X != Span[counter].X ||
+         Span[counter + rows].Length != Span[counter].Length ||
+         Span[counter + rows].Y != Span[counter].Y + rows)
+      {
+        break;
+      }
+    }
+    
+    if(rows >= SPAN_WINDOW_ROWS)
+    {
+      FillWindow(Span[counter].X, Span[counter].Y, Span[counter].Length, rows);
+      continue;
+    }
+    for(index = 0; index < rows; index++)
+    {
+      BSP_LCD_DrawHLine(Span[counter + index].X, Span[counter + index].Y, Span[counter].Length);
+    }
+  }
+  
+  LCD_IO_End();
+  
+  SpanCount = 0;
+}
+
+/**
+  * @brief  Adds a span to the shape, dropped if it's not all in the LCD
+  *         as the driver drops lines. It's merged with the previous one
+  *         when they touch.
+  * @param  Xpos: X position
+  * @param  Ypos: Y position
+  * @param  Length: Span length
+  * @retval None
+  */
+static void SpanAdd(uint16_t Xpos, uint16_t Ypos, uint16_t Length)
+{
+  SpanTypeDef *last = NULL;
+  
+  if((Length == 0) || (Xpos + Length > BSP_LCD_GetXSize()) || (Ypos >= BSP_LCD_GetYSize()))
+  {
+    return;
+  }
+  
+  if(SpanCount > 0)
+  {
+    last = &Span[SpanCount - 1];
+  }
+  if(last != NULL && last->Y == Ypos &&
+     Xpos <= last->X + last->Length && Xpos + Length >= last->X)
+  {
+    if(Xpos + Length > last->X + last->Length)
+    {
+      last->Length = Xpos + Length - last->X;
+    }
+    if(Xpos < last->X)
+    {
+      last->Length += last->X - Xpos;
+      last->X = Xpos;
+    }
+    return;
+  }
+  
+  if(SpanCount == SPAN_MAX)
+  {
+    SpanFlush();
+  }
+  Span[SpanCount].X = Xpos;
+  Span[SpanCount].Y = Ypos;
+  Span[SpanCount].Length = Length;
+  SpanCount++;
+}
+
+/**
+  * @brief  Ends a shape, its spans are sent unless it's part of another.
+  * @param  None
+  * @retval None
+  */
+static void SpanEnd(void)
+{
+  if(--SpanDepth == 0)
+  {
+    SpanFlush();
+  }
+}
+
 /**
   * @}
   */  
@@ -172,6 +172,9 @@ void     BSP_LCD_FillEllipse(int Xpos, int Ypos, int XRadius, int YRadius);
 void     BSP_LCD_DisplayOff(void);
 void     BSP_LCD_DisplayOn(void);
 
+void     BSP_LCD_Flush(void);
+void     BSP_LCD_Invalidate(void);
+
 /**
   * @}
   */
@@ -171,6 +171,9 @@ init_todoo(void)
     
     todoo = malloc(sizeof(struct Todoo_data));
     todoo->parameters = malloc(sizeof(struct Parameters));
+    todoo->activity = malloc(MAX_ACTIVITY_SCHEDULE*sizeof(struct Activity));
+    todoo->parameters->num_activity = 0;
+    todoo->schedule = 0;
 }
 // 1 ///////////////////////////////////////////////////// 1 ///////////////////////////////////////////////////
 
@@ -0,0 +1,344 @@
+/*
+ * CHIC - China Hardware Innovation Camp - Todoo
+ * https://chi.camp/projects/todoo/
+ *
+ * Off-screen rasterizer of the screen task (see screen_tile.h).
+ *
+ * The helpers use static buffers and are meant to be called from the
+ * screen task only.
+*/
+
+#include <string.h>
+
+#include "os/os.h"
+
+#include "screen_tile.h"
+
+/* Bytes of an image row read at once, a row of RGB565 pixels at most */
+static uint8_t screen_tile_io[SCREEN_TILE_SIZE * 2];
+
+/* Palette of an indexed image, high byte first */
+static uint8_t screen_tile_lut[256][2];
+
+/*
+* Grow rect to hold add as well, an empty rect (w is 0) becomes add.
+*/
+void screen_rect_union(struct screen_rect *rect, const struct screen_rect *add){
+    uint16_t x1, r1;
+
+    if(rect->w == 0){
+        *rect = *add;
+        return;
+    }
+
+    x1 = rect->x + rect->w > add->x + add->w ? rect->x + rect->w : add->x + add->w;
+    r1 = rect->r + rect->h > add->r + add->h ? rect->r + rect->h : add->r + add->h;
+    rect->x = rect->x < add->x ? rect->x : add->x;
+    rect->r = rect->r < add->r ? rect->r : add->r;
+    rect->w = x1 - rect->x;
+    rect->h = r1 - rect->r;
+}
+
+static void screen_tile_mark(struct screen_tile *tile, uint16_t x, uint16_t r,
+                             uint16_t w, uint16_t h){
+    struct screen_rect add = { x, r, w, h };
+
+    screen_rect_union(&tile->drawn, &add);
+}
+
+/*
+* Whether the area of w x h pixels at x, r shows in the tile.
+*/
+int screen_tile_overlaps(const struct screen_tile *tile, uint16_t x,
+                         uint16_t r, uint16_t w, uint16_t h){
+    const struct screen_rect *a;
+
+    a = &tile->area;
+    return x < a->x + a->w && x + w > a->x && r < a->r + a->h && r + h > a->r;
+}
+
+static uint8_t *screen_tile_at(const struct screen_tile *tile, uint16_t x,
+                               uint16_t r){
+    return tile->buf + 2 * ((uint32_t) (r - tile->area.r) * tile->area.w +
+                            x - tile->area.x);
+}
+
+/*
+* Draw the part of the span of len pixels at x, r that is in the tile.
+*/
+static void screen_tile_span(struct screen_tile *tile, uint16_t x, uint16_t r,
+                             uint16_t len, uint16_t color){
+    const struct screen_rect *a;
+    uint16_t end;
+    uint8_t *p;
+
+    a = &tile->area;
+    if(r < a->r || r >= a->r + a->h){
+        return;
+    }
+    end = x + len;
+    if(x < a->x){
+        x = a->x;
+    }
+    if(end > a->x + a->w){
+        end = a->x + a->w;
+    }
+    if(x >= end){
+        return;
+    }
+
+    screen_tile_mark(tile, x, r, end - x, 1);
+    if(tile->buf == NULL){
+        return;
+    }
+
+    p = screen_tile_at(tile, x, r);
+    for(;x<end;x++){
+        *p++ = color >> 8;
+        *p++ = color;
+    }
+}
+
+/*
+* Set the tile up to draw area in buf, or to only gather what is drawn
+* with buf NULL.
+*/
+void screen_tile_init(struct screen_tile *tile, const struct screen_rect *area,
+                      uint8_t *buf){
+
+    tile->area = *area;
+    memset(&tile->drawn, 0, sizeof(tile->drawn));
+    tile->buf = buf;
+}
+
+/*
+* Whole tile, BSP_LCD_Clear().
+*/
+void screen_tile_fill(struct screen_tile *tile, uint16_t color){
+    uint16_t r;
+
+    for(r=0;r<tile->area.h;r++){
+        screen_tile_span(tile, tile->area.x, tile->area.r + r, tile->area.w, color);
+    }
+}
+
+/*
+* BSP_LCD_DrawHLine(), nothing is drawn past the right edge of the panel.
+*/
+void screen_tile_hline(struct screen_tile *tile, uint16_t x, uint16_t r,
+                       uint16_t len, uint16_t color){
+
+    if(x + len > SCREEN_TILE_SIZE){
+        return;
+    }
+    screen_tile_span(tile, x, r, len, color);
+}
+
+/*
+* BSP_LCD_DrawVLine(), nothing is drawn past the top edge of the panel.
+*/
+void screen_tile_vline(struct screen_tile *tile, uint16_t x, uint16_t r,
+                       uint16_t len, uint16_t color){
+    uint16_t i;
+
+    if(r + len > SCREEN_TILE_SIZE || x >= SCREEN_TILE_SIZE){
+        return;
+    }
+    for(i=0;i<len;i++){
+        screen_tile_span(tile, x, r + i, 1, color);
+    }
+}
+
+/*
+* BSP_LCD_FillRect(), which draws h + 1 rows.
+*/
+void screen_tile_rect(struct screen_tile *tile, uint16_t x, uint16_t r,
+                      uint16_t w, uint16_t h, uint16_t color){
+    uint16_t i;
+
+    for(i=0;i<=h;i++){
+        screen_tile_hline(tile, x, r + i, w, color);
+    }
+}
+
+/*
+* BSP_LCD_DisplayChar(), r being the bottom row of the character window.
+*/
+void screen_tile_char(struct screen_tile *tile, uint16_t x, uint16_t r,
+                      const sFONT *font, uint16_t fg, uint16_t bg, uint8_t ch){
+    const uint8_t *glyph, *row;
+    uint32_t line, bytes, offset, i, k, c;
+
+    if(!screen_tile_overlaps(tile, x, r, font->Width, font->Height)){
+        return;
+    }
+
+    bytes = (font->Width + 7) / 8;
+    offset = 8 * bytes - font->Width;
+    glyph = &font->table[(ch - ' ') * font->Height * bytes];
+
+    for(k=0;k<font->Height;k++){
+        /* The glyph is stored top row first */
+        row = glyph + bytes * (font->Height - 1 - k);
+        line = 0;
+        for(i=0;i<bytes;i++){
+            line = (line << 8) | row[i];
+        }
+        for(c=0;c<font->Width;c++){
+            screen_tile_span(tile, x + c, r + k, 1,
+                             line & (1 << (font->Width - c + offset - 1)) ? fg : bg);
+        }
+    }
+}
+
+/*
+* Get ready to draw the Todoo image at addr in the window of bottom left
+* corner x, r. -1 if there is no image there.
+*/
+int screen_tile_image_open(struct screen_tile_image *img, struct sst26_dev *dev,
+                           uint32_t addr, uint16_t x, uint16_t r){
+
+    memset(img, 0, sizeof(*img));
+    img->dev = dev;
+    img->addr = addr;
+    img->x = x;
+    img->r = r;
+    return todoo_image_read_hdr(dev, addr, &img->hdr);
+}
+
+/*
+* Rows k0 to k1 of an RLE565 image, columns c0 to c1. Rows are encoded on
+* their own: the offset of row k0 is kept, so that the next tiles, on the
+* same rows or above, don't decode the image from its start again.
+*/
+static int screen_tile_rle(struct screen_tile *tile, struct screen_tile_image *img,
+                           uint16_t k0, uint16_t k1, uint16_t c0, uint16_t c1){
+    struct sst26_stream stream;
+    uint32_t off;
+    uint16_t k, c, i, n;
+    uint8_t ctl;
+    int rc;
+
+    if(img->row > k0){
+        img->row = 0;
+        img->off = 0;
+    }
+    off = img->off;
+
+    if(sst26_stream_open(img->dev, &stream, img->addr + img->hdr.hdr_len + off)){
+        return -1;
+    }
+
+    rc = 0;
+    for(k=img->row;k<=k1 && rc == 0;k++){
+        if(k == k0){
+            img->row = k;
+            img->off = off;
+        }
+        c = 0;
+        while(c < img->hdr.width){
+            /* Literal pixels, or one repeated */
+            if(sst26_stream_read(&stream, &ctl, 1)){
+                rc = -1;
+                break;
+            }
+            n = ctl < 128 ? ctl + 1 : ctl - 126;
+            if(sst26_stream_read(&stream, screen_tile_io, ctl < 128 ? 2 * n : 2)){
+                rc = -1;
+                break;
+            }
+            off += ctl < 128 ? 1 + 2 * n : 3;
+
+            for(i=0;i<n;i++,c++){
+                if(k >= k0 && c >= c0 && c <= c1){
+                    memcpy(screen_tile_at(tile, img->x + c, img->r + k),
+                           screen_tile_io + (ctl < 128 ? 2 * i : 0), 2);
+                }
+            }
+        }
+    }
+
+    sst26_stream_close(&stream);
+    return rc;
+}
+
+/*
+* Rows k0 to k1 of a plain or indexed image, columns c0 to c1, read row by
+* row from where they are.
+*/
+static int screen_tile_rows(struct screen_tile *tile, struct screen_tile_image *img,
+                            uint16_t k0, uint16_t k1, uint16_t c0, uint16_t c1){
+    const struct todoo_image_hdr *hdr;
+    uint32_t pixels, bit, len, bpp, c;
+    uint16_t k;
+    uint8_t idx, *p;
+
+    hdr = &img->hdr;
+    pixels = img->addr + hdr->hdr_len;
+
+    if(hdr->format == TODOO_IMAGE_RGB565_BE){
+        for(k=k0;k<=k1;k++){
+            if(sst26_read((struct hal_flash *) img->dev,
+                          pixels + 2 * ((uint32_t) k * hdr->width + c0),
+                          screen_tile_at(tile, img->x + c0, img->r + k),
+                          2 * (c1 - c0 + 1))){
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    if(sst26_read((struct hal_flash *) img->dev, pixels, screen_tile_lut,
+                  hdr->colors * 2)){
+        return -1;
+    }
+
+    /* Indexes are packed across rows, first pixel in the high bits */
+    bpp = TODOO_IMAGE_PAL_BPP(hdr->format);
+    for(k=k0;k<=k1;k++){
+        bit = ((uint32_t) k * hdr->width + c0) * bpp;
+        len = ((bit % 8) + (c1 - c0 + 1) * bpp + 7) / 8;
+        if(sst26_read((struct hal_flash *) img->dev,
+                      pixels + hdr->colors * 2 + bit / 8, screen_tile_io, len)){
+            return -1;
+        }
+
+        p = screen_tile_at(tile, img->x + c0, img->r + k);
+        bit %= 8;
+        for(c=c0;c<=c1;c++,bit+=bpp){
+            idx = (screen_tile_io[bit / 8] >> (8 - bpp - bit % 8)) & ((1 << bpp) - 1);
+            *p++ = screen_tile_lut[idx][0];
+            *p++ = screen_tile_lut[idx][1];
+        }
+    }
+    return 0;
+}
+
+/*
+* The part of the image in the tile, ext_memory_bitmap_to_LCD().
+*/
+int screen_tile_image(struct screen_tile *tile, struct screen_tile_image *img){
+    const struct screen_rect *a;
+    uint16_t k0, k1, c0, c1;
+
+    a = &tile->area;
+    if(!screen_tile_overlaps(tile, img->x, img->r, img->hdr.width, img->hdr.height)){
+        return 0;
+    }
+
+    /* Rows and columns of the image in the tile */
+    k0 = a->r > img->r ? a->r - img->r : 0;
+    k1 = (a->r + a->h < img->r + img->hdr.height ? a->r + a->h : img->r + img->hdr.height) - img->r - 1;
+    c0 = a->x > img->x ? a->x - img->x : 0;
+    c1 = (a->x + a->w < img->x + img->hdr.width ? a->x + a->w : img->x + img->hdr.width) - img->x - 1;
+
+    screen_tile_mark(tile, img->x + c0, img->r + k0, c1 - c0 + 1, k1 - k0 + 1);
+    if(tile->buf == NULL){
+        return 0;
+    }
+
+    if(img->hdr.format == TODOO_IMAGE_RLE565){
+        return screen_tile_rle(tile, img, k0, k1, c0, c1);
+    }
+    return screen_tile_rows(tile, img, k0, k1, c0, c1);
+}
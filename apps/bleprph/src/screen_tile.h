@@ -0,0 +1,68 @@
+/*
+ * CHIC - China Hardware Innovation Camp - Todoo
+ * https://chi.camp/projects/todoo/
+ *
+ * Off-screen rasterizer of the screen task.
+ *
+ * A part of the screen is drawn in a RAM tile first, then sent to the LCD
+ * in a single window. The primitives follow the LCD functions they stand
+ * for pixel for pixel: coordinates are those of the panel memory, column
+ * and row, row 0 being the bottom of the screen (BSP_LCD_DrawHLine()).
+ *
+ * A tile without buffer draws nothing, it only gathers the area the
+ * primitives would draw.
+*/
+
+#ifndef SCREEN_TILE_H_INCLUDED
+#define SCREEN_TILE_H_INCLUDED
+
+#include <stdint.h>
+#include <SST26/SST26.h>
+#include "Fonts/fonts.h"
+#include "todoo_image.h"
+
+#define SCREEN_TILE_SIZE    128
+
+struct screen_rect {
+    uint16_t x;             /* Column */
+    uint16_t r;             /* Row */
+    uint16_t w;
+    uint16_t h;
+};
+
+struct screen_tile {
+    struct screen_rect area;    /* Of the panel held by buf */
+    struct screen_rect drawn;   /* Bounds of what was drawn, empty if w is 0 */
+    uint8_t *buf;               /* area.w * area.h pixels, high byte first */
+};
+
+/* Todoo image of the external memory, see screen_tile_image() */
+struct screen_tile_image {
+    struct sst26_dev *dev;
+    uint32_t addr;              /* Of the image header */
+    struct todoo_image_hdr hdr;
+    uint16_t x;                 /* Window of the image on the panel */
+    uint16_t r;
+    uint16_t row;               /* RLE565: row starting at off */
+    uint32_t off;
+};
+
+void screen_rect_union(struct screen_rect *rect, const struct screen_rect *add);
+void screen_tile_init(struct screen_tile *tile, const struct screen_rect *area,
+                      uint8_t *buf);
+int screen_tile_overlaps(const struct screen_tile *tile, uint16_t x,
+                         uint16_t r, uint16_t w, uint16_t h);
+void screen_tile_fill(struct screen_tile *tile, uint16_t color);
+void screen_tile_hline(struct screen_tile *tile, uint16_t x, uint16_t r,
+                       uint16_t len, uint16_t color);
+void screen_tile_vline(struct screen_tile *tile, uint16_t x, uint16_t r,
+                       uint16_t len, uint16_t color);
+void screen_tile_rect(struct screen_tile *tile, uint16_t x, uint16_t r,
+                      uint16_t w, uint16_t h, uint16_t color);
+void screen_tile_char(struct screen_tile *tile, uint16_t x, uint16_t r,
+                      const sFONT *font, uint16_t fg, uint16_t bg, uint8_t ch);
+int screen_tile_image_open(struct screen_tile_image *img, struct sst26_dev *dev,
+                           uint32_t addr, uint16_t x, uint16_t r);
+int screen_tile_image(struct screen_tile *tile, struct screen_tile_image *img);
+
+#endif
@@ -19,10 +19,12 @@
 #include <assert.h>
 #include <string.h>
 
+#include "syscfg/syscfg.h"
 #include "sysinit/sysinit.h"
 #include "os/os.h"
 #include "bsp/bsp.h"
 #include "hal/hal_gpio.h"
+#include "stats/stats.h"
 #ifdef ARCH_sim
 #include "mcu/mcu_sim.h"
 #endif
@@ -41,6 +43,14 @@
 
 /* Todoo structure */
 #include "todoo_data.h"
+#include "todoo_image.h"
+#include "todoo_asset.h"
+#include "flashtask.h"
+#include "screen_tile.h"
+
+#if MYNEWT_VAL(SCREEN_BENCH)
+#include "console/console.h"
+#endif
 
 #define BAR_LENGTH 436
 
@@ -56,13 +66,6 @@
 
 static volatile int g_task1_loops;
 
-static struct hal_spi_settings screen_SPI_settings = {
-    .data_order = HAL_SPI_MSB_FIRST,
-    .data_mode  = HAL_SPI_MODE3,
-    .baudrate   = 8000, // max 8000
-    .word_size  = HAL_SPI_WORD_SIZE_8BIT,
-};
-
 // GPIO declaration
 int g_led_pin;
 int ncs_lcd;
@@ -76,9 +79,59 @@ uint8_t rxbuf[5];
 
 /*
 * Image buffer to store an image during the transition between external 
-* SPI memory and the LCD.
+* SPI memory and the LCD, SCREEN_CHUNK_SIZE bytes are moved at once.
 */
-uint8_t image_buf[50];
+uint8_t image_buf[MYNEWT_VAL(SCREEN_CHUNK_SIZE)];
+
+/* Pixels decoded from a compressed picture, waiting to be sent */
+static uint8_t lcd_buf[MYNEWT_VAL(SCREEN_CHUNK_SIZE)];
+
+/* Palette of an indexed picture, RGB565 high byte first */
+static uint8_t lcd_lut[256][2];
+
+/*
+* External memory sharing SPI0 with the LCD, the LCD IO functions take the
+* bus through its lock so they never run in the middle of a flash transfer.
+*/
+static struct sst26_dev *screen_flash_dev;
+
+static void lcd_bus_acquire(void){
+    if(screen_flash_dev){
+        sst26_bus_acquire(screen_flash_dev);
+    }
+}
+
+static void lcd_bus_release(void){
+    if(screen_flash_dev){
+        sst26_bus_release(screen_flash_dev);
+    }
+}
+
+/*
+* Traffic to the LCD, "lcd" over newtmgr: tx_bytes / frames is what a
+* refresh of the activity screen costs on the SPI bus.
+*/
+STATS_SECT_START(lcd_stats)
+    STATS_SECT_ENTRY(frames)
+    STATS_SECT_ENTRY(tx_bytes)
+    STATS_SECT_ENTRY(selects)
+    STATS_SECT_ENTRY(chars)
+    STATS_SECT_ENTRY(chars_skipped)
+    STATS_SECT_ENTRY(bar_redraws)
+    STATS_SECT_ENTRY(tiles)
+STATS_SECT_END
+
+STATS_NAME_START(lcd_stats)
+    STATS_NAME(lcd_stats, frames)
+    STATS_NAME(lcd_stats, tx_bytes)
+    STATS_NAME(lcd_stats, selects)
+    STATS_NAME(lcd_stats, chars)
+    STATS_NAME(lcd_stats, chars_skipped)
+    STATS_NAME(lcd_stats, bar_redraws)
+    STATS_NAME(lcd_stats, tiles)
+STATS_NAME_END(lcd_stats)
+
+static STATS_SECT_DECL(lcd_stats) g_lcd_stats;
 
 /*
 * Refresh the time in ASCII format
@@ -193,82 +246,594 @@ int current_task_time_spend_calculation(struct Todoo_data *todoo, uint16_t activ
 }
 
 
+/*
+* Widths of the loading bar caps, see BSP_LCD_FillLoading()
+*/
+static const uint8_t Length_LUT[20] = {11,10,9,8,7,6,6,5,5,5,5,5,5,6,6,7,8,9,10,11};
+static const uint8_t CoinLength_LUT[20] = {20,18,16,14,12,11,9,8,7,6,4,4,3,2,1,1,0,0,0,0};
+
+/*
+* BSP_LCD_FillLoading() in a tile
+*/
+static void tile_fill_loading(struct screen_tile *tile, uint16_t Xpos, uint16_t Ypos,
+                              Orientation Orient, uint16_t color){
+    uint8_t i;
+
+    for(i=0;i<20;i++){
+        switch(Orient){
+        case TOP:
+            screen_tile_vline(tile, Xpos + i, Ypos+14-Length_LUT[i], Length_LUT[i], color);
+            break;
+        case BOTTOM:
+            screen_tile_vline(tile, Xpos + i, Ypos, Length_LUT[i], color);
+            break;
+        case LEFT:
+            screen_tile_hline(tile, Xpos, Ypos+i, Length_LUT[i], color);
+            break;
+        case RIGHT:
+            screen_tile_hline(tile, Xpos+14-Length_LUT[i], Ypos+i, Length_LUT[i], color);
+            break;
+        case TOPLEFT:
+            screen_tile_vline(tile, Xpos+i, Ypos, 8+CoinLength_LUT[i], color);
+            break;
+        case TOPRIGHT:
+            screen_tile_hline(tile, Xpos, Ypos+i, 8+CoinLength_LUT[19-i], color);
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+/*
+* Path of the time bar, one step per percentage. The bar goes up the left
+* side from 100 to 70%, along the top from 69 to 30% and down the right side
+* from 29 to 0%, a cap ahead of the part already filled:
+*  -left:  cap at row 281-13*p/5, filled from row 21
+*  -top:   cap at column 175-13*p/5, filled from column 0
+*  -right: cap at row 35+13*p/5, filled up to the top
+* The bounds of what each step draws, and of what it draws more than the
+* step above, are worked out from the same primitives (FillRect draws h + 1
+* rows, lines past an edge are not drawn).
+*/
+#define TIME_BAR_STEPS  101
+#define TIME_BAR_NO_CAP 0xff
+
+struct time_bar_step {
+    uint8_t cap;                /* Orientation, TIME_BAR_NO_CAP if none */
+    uint8_t cap_x;
+    uint8_t cap_r;
+    uint8_t rect[4];            /* Column, row, width, height as FillRect, none if width is 0 */
+    struct screen_rect area;    /* Bounds of what the step draws */
+    struct screen_rect added;   /* Bounds of what it draws over the step above */
+};
+
+static const struct time_bar_step time_bar_steps[TIME_BAR_STEPS] = {
+    { TOP,            108,  35, { 108,  49,  20,  93 }, { 108,  38,  20,  90 }, { 108,  38,  20,   8 } }, /*   0% */
+    { TOP,            108,  37, { 108,  51,  20,  91 }, { 108,  40,  20,  88 }, { 108,  40,  20,   9 } }, /*   1% */
+    { TOP,            108,  40, { 108,  54,  20,  88 }, { 108,  43,  20,  85 }, { 108,  43,  20,   8 } }, /*   2% */
+    { TOP,            108,  42, { 108,  56,  20,  86 }, { 108,  45,  20,  83 }, { 108,  45,  20,   9 } }, /*   3% */
+    { TOP,            108,  45, { 108,  59,  20,  83 }, { 108,  48,  20,  80 }, { 108,  48,  20,   9 } }, /*   4% */
+    { TOP,            108,  48, { 108,  62,  20,  80 }, { 108,  51,  20,  77 }, { 108,  51,  20,   8 } }, /*   5% */
+    { TOP,            108,  50, { 108,  64,  20,  78 }, { 108,  53,  20,  75 }, { 108,  53,  20,   9 } }, /*   6% */
+    { TOP,            108,  53, { 108,  67,  20,  75 }, { 108,  56,  20,  72 }, { 108,  56,  20,   8 } }, /*   7% */
+    { TOP,            108,  55, { 108,  69,  20,  73 }, { 108,  58,  20,  70 }, { 108,  58,  20,   9 } }, /*   8% */
+    { TOP,            108,  58, { 108,  72,  20,  70 }, { 108,  61,  20,  67 }, { 108,  61,  20,   9 } }, /*   9% */
+    { TOP,            108,  61, { 108,  75,  20,  67 }, { 108,  64,  20,  64 }, { 108,  64,  20,   8 } }, /*  10% */
+    { TOP,            108,  63, { 108,  77,  20,  65 }, { 108,  66,  20,  62 }, { 108,  66,  20,   9 } }, /*  11% */
+    { TOP,            108,  66, { 108,  80,  20,  62 }, { 108,  69,  20,  59 }, { 108,  69,  20,   8 } }, /*  12% */
+    { TOP,            108,  68, { 108,  82,  20,  60 }, { 108,  71,  20,  57 }, { 108,  71,  20,   9 } }, /*  13% */
+    { TOP,            108,  71, { 108,  85,  20,  57 }, { 108,  74,  20,  54 }, { 108,  74,  20,   9 } }, /*  14% */
+    { TOP,            108,  74, { 108,  88,  20,  54 }, { 108,  77,  20,  51 }, { 108,  77,  20,   8 } }, /*  15% */
+    { TOP,            108,  76, { 108,  90,  20,  52 }, { 108,  79,  20,  49 }, { 108,  79,  20,   9 } }, /*  16% */
+    { TOP,            108,  79, { 108,  93,  20,  49 }, { 108,  82,  20,  46 }, { 108,  82,  20,   8 } }, /*  17% */
+    { TOP,            108,  81, { 108,  95,  20,  47 }, { 108,  84,  20,  44 }, { 108,  84,  20,   9 } }, /*  18% */
+    { TOP,            108,  84, { 108,  98,  20,  44 }, { 108,  87,  20,  41 }, { 108,  87,  20,   9 } }, /*  19% */
+    { TOP,            108,  87, { 108, 101,  20,  41 }, { 108,  90,  20,  38 }, { 108,  90,  20,   8 } }, /*  20% */
+    { TOP,            108,  89, { 108, 103,  20,  39 }, { 108,  92,  20,  36 }, { 108,  92,  20,   9 } }, /*  21% */
+    { TOP,            108,  92, { 108, 106,  20,  36 }, { 108,  95,  20,  33 }, { 108,  95,  20,   8 } }, /*  22% */
+    { TOP,            108,  94, { 108, 108,  20,  34 }, { 108,  97,  20,  31 }, { 108,  97,  20,   9 } }, /*  23% */
+    { TOP,            108,  97, { 108, 111,  20,  31 }, { 108, 100,  20,  28 }, { 108, 100,  20,   9 } }, /*  24% */
+    { TOP,            108, 100, { 108, 114,  20,  28 }, { 108, 103,  20,  25 }, { 108, 103,  20,   8 } }, /*  25% */
+    { TOP,            108, 102, { 108, 116,  20,  26 }, { 108, 105,  20,  23 }, { 108, 105,  20,   9 } }, /*  26% */
+    { TOP,            108, 105, { 108, 119,  20,  23 }, { 108, 108,  20,  20 }, { 108, 108,  20,   8 } }, /*  27% */
+    { TOP,            108, 107, { 108, 121,  20,  21 }, { 108, 110,  20,  18 }, { 108, 110,  20,  13 } }, /*  28% */
+    { TOP,            108, 114, {   0,   0,   0,   0 }, { 108, 117,  20,  11 }, { 108, 117,  20,  11 } }, /*  29% */
+    { TIME_BAR_NO_CAP,   0,   0, {   0, 108, 108,  20 }, {   0, 108, 108,  20 }, { 100, 108,   8,  20 } }, /*  30% */
+    { LEFT,            95, 108, {   0, 108,  95,  20 }, {   0, 108, 106,  20 }, {  97, 108,   9,  20 } }, /*  31% */
+    { LEFT,            92, 108, {   0, 108,  92,  20 }, {   0, 108, 103,  20 }, {  95, 108,   8,  20 } }, /*  32% */
+    { LEFT,            90, 108, {   0, 108,  90,  20 }, {   0, 108, 101,  20 }, {  92, 108,   9,  20 } }, /*  33% */
+    { LEFT,            87, 108, {   0, 108,  87,  20 }, {   0, 108,  98,  20 }, {  89, 108,   9,  20 } }, /*  34% */
+    { LEFT,            84, 108, {   0, 108,  84,  20 }, {   0, 108,  95,  20 }, {  87, 108,   8,  20 } }, /*  35% */
+    { LEFT,            82, 108, {   0, 108,  82,  20 }, {   0, 108,  93,  20 }, {  84, 108,   9,  20 } }, /*  36% */
+    { LEFT,            79, 108, {   0, 108,  79,  20 }, {   0, 108,  90,  20 }, {  82, 108,   8,  20 } }, /*  37% */
+    { LEFT,            77, 108, {   0, 108,  77,  20 }, {   0, 108,  88,  20 }, {  79, 108,   9,  20 } }, /*  38% */
+    { LEFT,            74, 108, {   0, 108,  74,  20 }, {   0, 108,  85,  20 }, {  76, 108,   9,  20 } }, /*  39% */
+    { LEFT,            71, 108, {   0, 108,  71,  20 }, {   0, 108,  82,  20 }, {  74, 108,   8,  20 } }, /*  40% */
+    { LEFT,            69, 108, {   0, 108,  69,  20 }, {   0, 108,  80,  20 }, {  71, 108,   9,  20 } }, /*  41% */
+    { LEFT,            66, 108, {   0, 108,  66,  20 }, {   0, 108,  77,  20 }, {  69, 108,   8,  20 } }, /*  42% */
+    { LEFT,            64, 108, {   0, 108,  64,  20 }, {   0, 108,  75,  20 }, {  66, 108,   9,  20 } }, /*  43% */
+    { LEFT,            61, 108, {   0, 108,  61,  20 }, {   0, 108,  72,  20 }, {  63, 108,   9,  20 } }, /*  44% */
+    { LEFT,            58, 108, {   0, 108,  58,  20 }, {   0, 108,  69,  20 }, {  61, 108,   8,  20 } }, /*  45% */
+    { LEFT,            56, 108, {   0, 108,  56,  20 }, {   0, 108,  67,  20 }, {  58, 108,   9,  20 } }, /*  46% */
+    { LEFT,            53, 108, {   0, 108,  53,  20 }, {   0, 108,  64,  20 }, {  56, 108,   8,  20 } }, /*  47% */
+    { LEFT,            51, 108, {   0, 108,  51,  20 }, {   0, 108,  62,  20 }, {  53, 108,   9,  20 } }, /*  48% */
+    { LEFT,            48, 108, {   0, 108,  48,  20 }, {   0, 108,  59,  20 }, {  50, 108,   9,  20 } }, /*  49% */
+    { LEFT,            45, 108, {   0, 108,  45,  20 }, {   0, 108,  56,  20 }, {  48, 108,   8,  20 } }, /*  50% */
+    { LEFT,            43, 108, {   0, 108,  43,  20 }, {   0, 108,  54,  20 }, {  45, 108,   9,  20 } }, /*  51% */
+    { LEFT,            40, 108, {   0, 108,  40,  20 }, {   0, 108,  51,  20 }, {  43, 108,   8,  20 } }, /*  52% */
+    { LEFT,            38, 108, {   0, 108,  38,  20 }, {   0, 108,  49,  20 }, {  40, 108,   9,  20 } }, /*  53% */
+    { LEFT,            35, 108, {   0, 108,  35,  20 }, {   0, 108,  46,  20 }, {  37, 108,   9,  20 } }, /*  54% */
+    { LEFT,            32, 108, {   0, 108,  32,  20 }, {   0, 108,  43,  20 }, {  35, 108,   8,  20 } }, /*  55% */
+    { LEFT,            30, 108, {   0, 108,  30,  20 }, {   0, 108,  41,  20 }, {  32, 108,   9,  20 } }, /*  56% */
+    { LEFT,            27, 108, {   0, 108,  27,  20 }, {   0, 108,  38,  20 }, {  30, 108,   8,  20 } }, /*  57% */
+    { LEFT,            25, 108, {   0, 108,  25,  20 }, {   0, 108,  36,  20 }, {  27, 108,   9,  20 } }, /*  58% */
+    { LEFT,            22, 108, {   0, 108,  22,  20 }, {   0, 108,  33,  20 }, {  24, 108,   9,  20 } }, /*  59% */
+    { LEFT,            19, 108, {   0, 108,  19,  20 }, {   0, 108,  30,  20 }, {  22, 108,   8,  20 } }, /*  60% */
+    { LEFT,            17, 108, {   0, 108,  17,  20 }, {   0, 108,  28,  20 }, {  19, 108,   9,  20 } }, /*  61% */
+    { LEFT,            14, 108, {   0, 108,  14,  20 }, {   0, 108,  25,  20 }, {  17, 108,   8,  20 } }, /*  62% */
+    { LEFT,            12, 108, {   0, 108,  12,  20 }, {   0, 108,  23,  20 }, {  14, 108,   9,  20 } }, /*  63% */
+    { LEFT,             9, 108, {   0, 108,   9,  20 }, {   0, 108,  20,  20 }, {  11, 108,   9,  20 } }, /*  64% */
+    { LEFT,             6, 108, {   0, 108,   6,  20 }, {   0, 108,  17,  20 }, {   9, 108,   8,  20 } }, /*  65% */
+    { LEFT,             4, 108, {   0, 108,   4,  20 }, {   0, 108,  15,  20 }, {   6, 108,   9,  20 } }, /*  66% */
+    { LEFT,             1, 108, {   0, 108,   1,  20 }, {   0, 108,  12,  20 }, {   0, 108,   1,  20 } }, /*  67% */
+    { LEFT,             1, 108, {   0,   0,   0,   0 }, {   1, 108,  11,  20 }, {   5, 108,   7,  20 } }, /*  68% */
+    { LEFT,             0, 108, {   0,   0,   0,   0 }, {   0, 108,  11,  20 }, {   0, 108,  11,  20 } }, /*  69% */
+    { TIME_BAR_NO_CAP,   0,   0, {   0,  21,  20,  86 }, {   0,  21,  20,  87 }, {   1, 102,  18,   6 } }, /*  70% */
+    { BOTTOM,           0,  97, {   0,  21,  20,  77 }, {   0,  21,  20,  87 }, {   0,  99,  20,   9 } }, /*  71% */
+    { BOTTOM,           0,  94, {   0,  21,  20,  74 }, {   0,  21,  20,  84 }, {   0,  97,  20,   8 } }, /*  72% */
+    { BOTTOM,           0,  92, {   0,  21,  20,  72 }, {   0,  21,  20,  82 }, {   0,  94,  20,   9 } }, /*  73% */
+    { BOTTOM,           0,  89, {   0,  21,  20,  69 }, {   0,  21,  20,  79 }, {   0,  91,  20,   9 } }, /*  74% */
+    { BOTTOM,           0,  86, {   0,  21,  20,  66 }, {   0,  21,  20,  76 }, {   0,  89,  20,   8 } }, /*  75% */
+    { BOTTOM,           0,  84, {   0,  21,  20,  64 }, {   0,  21,  20,  74 }, {   0,  86,  20,   9 } }, /*  76% */
+    { BOTTOM,           0,  81, {   0,  21,  20,  61 }, {   0,  21,  20,  71 }, {   0,  84,  20,   8 } }, /*  77% */
+    { BOTTOM,           0,  79, {   0,  21,  20,  59 }, {   0,  21,  20,  69 }, {   0,  81,  20,   9 } }, /*  78% */
+    { BOTTOM,           0,  76, {   0,  21,  20,  56 }, {   0,  21,  20,  66 }, {   0,  78,  20,   9 } }, /*  79% */
+    { BOTTOM,           0,  73, {   0,  21,  20,  53 }, {   0,  21,  20,  63 }, {   0,  76,  20,   8 } }, /*  80% */
+    { BOTTOM,           0,  71, {   0,  21,  20,  51 }, {   0,  21,  20,  61 }, {   0,  73,  20,   9 } }, /*  81% */
+    { BOTTOM,           0,  68, {   0,  21,  20,  48 }, {   0,  21,  20,  58 }, {   0,  71,  20,   8 } }, /*  82% */
+    { BOTTOM,           0,  66, {   0,  21,  20,  46 }, {   0,  21,  20,  56 }, {   0,  68,  20,   9 } }, /*  83% */
+    { BOTTOM,           0,  63, {   0,  21,  20,  43 }, {   0,  21,  20,  53 }, {   0,  65,  20,   9 } }, /*  84% */
+    { BOTTOM,           0,  60, {   0,  21,  20,  40 }, {   0,  21,  20,  50 }, {   0,  63,  20,   8 } }, /*  85% */
+    { BOTTOM,           0,  58, {   0,  21,  20,  38 }, {   0,  21,  20,  48 }, {   0,  60,  20,   9 } }, /*  86% */
+    { BOTTOM,           0,  55, {   0,  21,  20,  35 }, {   0,  21,  20,  45 }, {   0,  58,  20,   8 } }, /*  87% */
+    { BOTTOM,           0,  53, {   0,  21,  20,  33 }, {   0,  21,  20,  43 }, {   0,  55,  20,   9 } }, /*  88% */
+    { BOTTOM,           0,  50, {   0,  21,  20,  30 }, {   0,  21,  20,  40 }, {   0,  52,  20,   9 } }, /*  89% */
+    { BOTTOM,           0,  47, {   0,  21,  20,  27 }, {   0,  21,  20,  37 }, {   0,  50,  20,   8 } }, /*  90% */
+    { BOTTOM,           0,  45, {   0,  21,  20,  25 }, {   0,  21,  20,  35 }, {   0,  47,  20,   9 } }, /*  91% */
+    { BOTTOM,           0,  42, {   0,  21,  20,  22 }, {   0,  21,  20,  32 }, {   0,  45,  20,   8 } }, /*  92% */
+    { BOTTOM,           0,  40, {   0,  21,  20,  20 }, {   0,  21,  20,  30 }, {   0,  42,  20,   9 } }, /*  93% */
+    { BOTTOM,           0,  37, {   0,  21,  20,  17 }, {   0,  21,  20,  27 }, {   0,  39,  20,   9 } }, /*  94% */
+    { BOTTOM,           0,  34, {   0,  21,  20,  14 }, {   0,  21,  20,  24 }, {   0,  37,  20,   8 } }, /*  95% */
+    { BOTTOM,           0,  32, {   0,  21,  20,  12 }, {   0,  21,  20,  22 }, {   0,  34,  20,   9 } }, /*  96% */
+    { BOTTOM,           0,  29, {   0,  21,  20,   9 }, {   0,  21,  20,  19 }, {   0,  32,  20,   8 } }, /*  97% */
+    { BOTTOM,           0,  27, {   0,  21,  20,   7 }, {   0,  21,  20,  17 }, {   0,  29,  20,   9 } }, /*  98% */
+    { BOTTOM,           0,  24, {   0,  21,  20,   4 }, {   0,  21,  20,  14 }, {   0,  26,  20,   9 } }, /*  99% */
+    { BOTTOM,           0,  21, {   0,  21,  20,   1 }, {   0,  21,  20,  11 }, {   0,  21,  20,  11 } }  /* 100% */
+};
+
 /* 
 *  Draw the time bar according to the activity spend time
 */ 
-void draw_time_bar(uint32_t task_percent){
+void draw_time_bar(struct screen_tile *tile, uint32_t task_percent){
+    const struct time_bar_step *step;
 
-    uint32_t temp;
+    if(task_percent >= TIME_BAR_STEPS){
+        return;
+    }
+    step = &time_bar_steps[task_percent];
+    if(!screen_tile_overlaps(tile, step->area.x, step->area.r, step->area.w, step->area.h)){
+        return;
+    }
 
-    BSP_LCD_SetTextColor(LCD_COLOR_WHITE);
+    if(step->cap != TIME_BAR_NO_CAP){
+        tile_fill_loading(tile, step->cap_x, step->cap_r, (Orientation) step->cap, LCD_COLOR_WHITE);
+    }
+    if(step->rect[2]){
+        screen_tile_rect(tile, step->rect[0], step->rect[1], step->rect[2], step->rect[3],
+                         LCD_COLOR_WHITE);
+    }
+}
 
-    if(task_percent>70){
+/* 
+*  Initialize time bar graphics in red
+*/ 
+void initialize_screen_bar(struct screen_tile *tile){
+
+    screen_tile_rect(tile, 0, 0, 128, 20, LCD_COLOR_RED);   //Bottom
+    screen_tile_rect(tile, 108, 0, 20, 128, LCD_COLOR_RED); //Right
+    screen_tile_rect(tile, 20, 108, 88, 20, LCD_COLOR_RED); //Top
+    screen_tile_rect(tile, 0, 20, 20, 108, LCD_COLOR_RED);  //Left
+    tile_fill_loading(tile, 0, 21, BOTTOM, LCD_COLOR_WHITE);
+    tile_fill_loading(tile, 0, 23, BOTTOM, LCD_COLOR_WHITE);
+}
 
-        temp = 281-(13*task_percent)/5;
-        BSP_LCD_FillLoading(0, (uint16_t) temp, BOTTOM);
-        BSP_LCD_FillRect(0, 21, 20, temp-20);
-    
-    }else if(task_percent>69){
+static void lcd_write_pixels(uint8_t *buf, uint32_t len);
 
-        BSP_LCD_FillRect(0, 21, 20, 86);
+/*
+* Tile the screen is drawn in before it's sent to the LCD, narrower areas
+* get taller tiles. Bigger tiles need less windows to be set up.
+*/
+#define LCD_TILE_PIXELS (MYNEWT_VAL(SCREEN_TILE_WIDTH) * MYNEWT_VAL(SCREEN_TILE_HEIGHT))
 
-    }else if(task_percent>68){
-        
-        BSP_LCD_FillLoading(0, 108, LEFT);
+static uint8_t lcd_tile_buf[LCD_TILE_PIXELS * 2];
 
-    }else if(task_percent>67){
-        
-        BSP_LCD_FillLoading(1, 108, LEFT);
+/*
+* Draw an area of the screen with draw, one tile at a time, each of them
+* sent to the LCD in a single window.
+*/
+static void lcd_render(const struct screen_rect *rect,
+                       void (*draw)(struct screen_tile *tile)){
+    struct screen_tile tile;
+    struct screen_rect area;
+    uint16_t x, r, h;
+
+    /* Memory access control of the bitmaps: MY = 0, MX = 1, MV = 0, ML = 0 */
+    st7735_WriteReg(LCD_REG_54, 0x48);
+
+    area.w = rect->w < MYNEWT_VAL(SCREEN_TILE_WIDTH) ?
+             rect->w : MYNEWT_VAL(SCREEN_TILE_WIDTH);
+    h = LCD_TILE_PIXELS / area.w;
+
+    for(r=rect->r;r<rect->r+rect->h;r+=area.h){
+        area.r = r;
+        area.h = rect->r + rect->h - r < h ? rect->r + rect->h - r : h;
+        for(x=rect->x;x<rect->x+rect->w;x+=area.w){
+            area.x = x;
+            area.w = rect->x + rect->w - x < MYNEWT_VAL(SCREEN_TILE_WIDTH) ?
+                     rect->x + rect->w - x : MYNEWT_VAL(SCREEN_TILE_WIDTH);
+
+            screen_tile_init(&tile, &area, lcd_tile_buf);
+            draw(&tile);
+
+            /* The picture was read from flash, the tile is sent at once */
+            LCD_IO_Begin();
+            st7735_SetDisplayWindow(area.x, area.r, area.w, area.h);
+            LCD_IO_WriteReg(LCD_REG_44);
+            lcd_write_pixels(lcd_tile_buf, 2 * area.w * area.h);
+            LCD_IO_End();
+            STATS_INC(g_lcd_stats, tiles);
+        }
+        area.w = rect->w < MYNEWT_VAL(SCREEN_TILE_WIDTH) ?
+                 rect->w : MYNEWT_VAL(SCREEN_TILE_WIDTH);
+    }
+
+    st7735_SetDisplayWindow(0, 0, BSP_LCD_GetXSize(), BSP_LCD_GetYSize());
+    BSP_LCD_Invalidate();
+}
+
+/*
+* The activity screen is refreshed every second but little of it changes.
+* It's kept as a list of what it shows: the time bar between two
+* percentages, a picture and characters. Only the areas where the list
+* changed are drawn again, in tiles, everything in them at once.
+*/
+#define LCD_CELLS       96
+#define LCD_DIRTY_RECTS 8
+#define LCD_BAR_NONE    0xffffffff
+
+/* Character on the screen */
+struct lcd_cell {
+    uint16_t x;
+    uint16_t y;
+    sFONT   *font;
+    uint16_t fg;
+    uint16_t bg;
+    uint8_t  ch;
+};
 
-    }else if(task_percent>30){
+static struct lcd_cell lcd_cells[LCD_CELLS];
+static uint32_t lcd_cell_count;
 
-        temp = 175-(13*task_percent)/5;
-        BSP_LCD_FillLoading((uint16_t) temp, 108,LEFT);
-        BSP_LCD_FillRect(0, 108, temp, 20);
+/* The time bar shows all the percentages from start down to percent */
+static uint32_t lcd_bar_start = LCD_BAR_NONE;
+static uint32_t lcd_bar_percent = LCD_BAR_NONE;
 
-    }else if(task_percent>29){
+/* Picture of the activity, its image held while shown */
+static struct screen_tile_image lcd_pic;
+static struct todoo_asset lcd_pic_asset;
+static uint8_t lcd_pic_shown;
 
-        BSP_LCD_FillRect(0, 108, 108, 20);
+/* Areas to draw again */
+static struct screen_rect lcd_dirty[LCD_DIRTY_RECTS];
+static uint32_t lcd_dirty_count;
 
-    }else if(task_percent>28){
+static void lcd_dirty_add(const struct screen_rect *rect){
+    struct screen_rect u;
+    uint32_t i;
 
-        BSP_LCD_FillLoading(108, 114, TOP);
+    if(rect->w == 0 || rect->h == 0){
+        return;
+    }
 
+    /* Merged with an area when that doesn't draw more */
+    for(i=0;i<lcd_dirty_count;i++){
+        u = lcd_dirty[i];
+        screen_rect_union(&u, rect);
+        if((uint32_t) u.w * u.h <= (uint32_t) lcd_dirty[i].w * lcd_dirty[i].h +
+                                   (uint32_t) rect->w * rect->h){
+            lcd_dirty[i] = u;
+            return;
+        }
+    }
+
+    if(lcd_dirty_count == LCD_DIRTY_RECTS){
+        screen_rect_union(&lcd_dirty[LCD_DIRTY_RECTS - 1], rect);
+        return;
+    }
+    lcd_dirty[lcd_dirty_count++] = *rect;
+}
+
+static void activity_draw(struct screen_tile *tile){
+    const struct lcd_cell *cell;
+    uint32_t q;
+
+    screen_tile_fill(tile, LCD_COLOR_WHITE);
+    if(lcd_pic_shown){
+        screen_tile_image(tile, &lcd_pic);
+    }
+    initialize_screen_bar(tile);
+
+    for(q=lcd_bar_start;q!=LCD_BAR_NONE && q>=lcd_bar_percent;q--){
+        draw_time_bar(tile, q);
+        if(q == 0){
+            break;
+        }
+    }
+
+    for(cell=lcd_cells;cell<lcd_cells+lcd_cell_count;cell++){
+        screen_tile_char(tile, cell->x, BSP_LCD_GetYSize() - cell->y - cell->font->Height,
+                         cell->font, cell->fg, cell->bg, cell->ch);
+    }
+}
+
+/*
+* Start the activity screen over, drawn in full on the next lcd_flush().
+*/
+static void lcd_reset(void){
+    struct screen_rect all = { 0, 0, BSP_LCD_GetXSize(), BSP_LCD_GetYSize() };
+
+    lcd_cell_count = 0;
+    lcd_bar_start = LCD_BAR_NONE;
+    lcd_bar_percent = LCD_BAR_NONE;
+    if(lcd_pic_shown){
+        todoo_asset_put(&lcd_pic_asset);
+    }
+    lcd_pic_shown = 0;
+    lcd_dirty_count = 0;
+    lcd_dirty_add(&all);
+}
+
+/*
+* Show the picture of an asset at Xpos, Ypos (see ext_memory_bitmap_to_LCD()).
+*/
+static void lcd_picture(uint16_t Xpos, uint16_t Ypos, uint16_t id){
+    struct screen_rect rect;
+
+    if(lcd_pic_shown){
+        todoo_asset_put(&lcd_pic_asset);
+        lcd_pic_shown = 0;
+    }
+    if(todoo_asset_get(id, &lcd_pic_asset)){
+        return;
+    }
+    if(screen_tile_image_open(&lcd_pic, my_sst26_dev, lcd_pic_asset.addr, Xpos, 0)){
+        todoo_asset_put(&lcd_pic_asset);
+        return;
+    }
+    lcd_pic.r = BSP_LCD_GetYSize() - Ypos - lcd_pic.hdr.height;
+    lcd_pic_shown = 1;
+
+    rect.x = lcd_pic.x;
+    rect.r = lcd_pic.r;
+    rect.w = lcd_pic.hdr.width;
+    rect.h = lcd_pic.hdr.height;
+    lcd_dirty_add(&rect);
+}
+
+/*
+* Show a character, with the current font and colours.
+*/
+static void lcd_char(uint16_t x, uint16_t y, uint8_t ch){
+    struct lcd_cell *cell;
+    struct screen_rect rect;
+    sFONT *font;
+    uint32_t i;
+
+    font = BSP_LCD_GetFont();
+    if(x + font->Width > BSP_LCD_GetXSize() || y + font->Height > BSP_LCD_GetYSize()){
+        return;
+    }
+
+    for(i=0;i<lcd_cell_count;i++){
+        if(lcd_cells[i].x == x && lcd_cells[i].y == y && lcd_cells[i].font == font){
+            break;
+        }
+    }
+    cell = &lcd_cells[i];
+    if(i == lcd_cell_count){
+        if(lcd_cell_count == LCD_CELLS){
+            return;
+        }
+        /* New cell, nothing shown there yet */
+        lcd_cell_count++;
+        cell->x = x;
+        cell->y = y;
+        cell->font = font;
+        cell->ch = 0;
+    }
+
+    if(cell->ch == ch && cell->fg == BSP_LCD_GetTextColor() &&
+       cell->bg == BSP_LCD_GetBackColor()){
+        STATS_INC(g_lcd_stats, chars_skipped);
+        return;
+    }
+    STATS_INC(g_lcd_stats, chars);
+
+    cell->ch = ch;
+    cell->fg = BSP_LCD_GetTextColor();
+    cell->bg = BSP_LCD_GetBackColor();
+
+    rect.x = x;
+    rect.r = BSP_LCD_GetYSize() - y - font->Height;
+    rect.w = font->Width;
+    rect.h = font->Height;
+    lcd_dirty_add(&rect);
+}
+
+/*
+* BSP_LCD_DisplayStringAtLine() through lcd_char().
+*/
+static void lcd_string_line(uint16_t line, const uint8_t *text){
+    sFONT *font;
+    uint16_t x;
+
+    font = BSP_LCD_GetFont();
+    for(x=0;*text && x + font->Width <= BSP_LCD_GetXSize();x+=font->Width){
+        lcd_char(x, line * font->Height, *text++);
+    }
+}
+
+/*
+* Show the time bar at task_percent, the percentages it went through since
+* the screen was started over included.
+*/
+static void lcd_time_bar(uint32_t task_percent){
+    struct screen_rect rect = { 0, 0, 0, 0 };
+    uint32_t q;
+
+    if(task_percent >= TIME_BAR_STEPS){
+        task_percent = TIME_BAR_STEPS - 1;
+    }
+    if(task_percent == lcd_bar_percent){
+        return;
+    }
+    STATS_INC(g_lcd_stats, bar_redraws);
+
+    if(lcd_bar_percent == LCD_BAR_NONE || task_percent > lcd_bar_percent){
+        /* Started or given back, all of the percentages in between change */
+        q = lcd_bar_percent == LCD_BAR_NONE ? task_percent : lcd_bar_percent;
+        for(;q<=task_percent;q++){
+            screen_rect_union(&rect, &time_bar_steps[q].area);
+        }
     }else{
+        /* Only the sliver the new percentages fill and the cap move */
+        for(q=task_percent;q<lcd_bar_percent;q++){
+            screen_rect_union(&rect, &time_bar_steps[q].added);
+        }
+    }
+    lcd_dirty_add(&rect);
+
+    if(lcd_bar_start == LCD_BAR_NONE || task_percent > lcd_bar_start){
+        lcd_bar_start = task_percent;
+    }
+    lcd_bar_percent = task_percent;
+}
+
+/*
+* Draw the areas of the activity screen that changed.
+*/
+static void lcd_flush(void){
+    uint32_t i;
 
-        temp = 35+(13*task_percent)/5;
-        BSP_LCD_FillLoading(108, (uint16_t) temp, TOP);
-        BSP_LCD_FillRect(108, temp+14, 20, 128-temp);
+    for(i=0;i<lcd_dirty_count;i++){
+        lcd_render(&lcd_dirty[i], activity_draw);
+    }
+    lcd_dirty_count = 0;
+}
 
+/*
+* Draw the picture of an asset of the external memory, if there is one.
+*/
+static void asset_to_LCD(uint16_t Xpos, uint16_t Ypos, uint16_t id){
+    struct todoo_asset asset;
+
+    if(todoo_asset_get(id, &asset) == 0){
+        ext_memory_bitmap_to_LCD(Xpos, Ypos, asset.addr, (struct hal_flash *) my_sst26_dev);
+        todoo_asset_put(&asset);
     }
 }
 
-/* 
-*  Initialize time bar graphics in red
-*/ 
-void initialize_screen_bar(){
+#if MYNEWT_VAL(SCREEN_BENCH)
+/*
+* Draw each shape of the BSP once and print the chip selects and bytes it
+* cost on the bus, from the "lcd" stats.
+*/
+static void screen_bench_shapes(void){
+    static Point points[] = { {10, 10}, {60, 20}, {100, 90}, {40, 110}, {5, 70} };
+    static const char *names[] = {
+        "circle", "fill circle", "ellipse", "fill ellipse", "line",
+        "polygon", "fill polygon"
+    };
+    uint32_t selects, bytes;
+    int i;
+
+    for(i=0;i<sizeof(names)/sizeof(names[0]);i++){
+        BSP_LCD_Clear(LCD_COLOR_WHITE);
+        BSP_LCD_Flush();
+        BSP_LCD_SetTextColor(LCD_COLOR_BLUE);
+
+        selects = g_lcd_stats.selects;
+        bytes = g_lcd_stats.tx_bytes;
+        switch(i){
+        case 0: BSP_LCD_DrawCircle(64, 64, 40); break;
+        case 1: BSP_LCD_FillCircle(64, 64, 40); break;
+        case 2: BSP_LCD_DrawEllipse(64, 64, 50, 30); break;
+        case 3: BSP_LCD_FillEllipse(64, 64, 50, 30); break;
+        case 4: BSP_LCD_DrawLine(3, 120, 125, 7); break;
+        case 5: BSP_LCD_DrawPolygon(points, 5); break;
+        case 6: BSP_LCD_FillPolygon(points, 5); break;
+        }
+        BSP_LCD_Flush();
 
-    BSP_LCD_SetTextColor(LCD_COLOR_RED);
-    BSP_LCD_FillRect(0, 0, 128, 20);   //Bottom
-    BSP_LCD_FillRect(108, 0, 20, 128); //Right
-    BSP_LCD_FillRect(20, 108, 88, 20); //Top
-    BSP_LCD_FillRect(0, 20, 20, 108);   //Left
-    BSP_LCD_SetTextColor(LCD_COLOR_WHITE);
-    BSP_LCD_FillLoading(0, 21, BOTTOM);
-    BSP_LCD_FillLoading(0, 23, BOTTOM);
-    BSP_LCD_SetTextColor(LCD_COLOR_WHITE);
-    BSP_LCD_SetBackColor(LCD_COLOR_RED);
+        console_printf("screen bench %s: %lu selects, %lu bytes\n", names[i],
+                       (unsigned long) (g_lcd_stats.selects - selects),
+                       (unsigned long) (g_lcd_stats.tx_bytes - bytes));
+    }
 }
 
+/*
+* Print what bringing up the LCD cost, boot_usecs from before the first
+* command to the end of the first clear, then draw the full screen
+* pictures of the external memory in a loop and print the frame rate of
+* each to the console, in hundredths of frames/s.
+*/
+static void screen_bench(uint32_t boot_usecs){
+    static const uint16_t pics[] = {
+        TODOO_ASSET_BRAND_PIC, TODOO_ASSET_ADV_REQ_PIC, TODOO_ASSET_SHARING_PIC
+    };
+    uint32_t start, usecs;
+    int i, n;
+
+    console_printf("screen bench boot: %lu us, %lu selects, %lu bytes\n",
+                   (unsigned long) boot_usecs, (unsigned long) g_lcd_stats.selects,
+                   (unsigned long) g_lcd_stats.tx_bytes);
+
+    for(i=0;i<sizeof(pics)/sizeof(pics[0]);i++){
+        start = os_cputime_get32();
+        for(n=0;n<MYNEWT_VAL(SCREEN_BENCH_FRAMES);n++){
+            asset_to_LCD(0, 0, pics[i]);
+        }
+        usecs = os_cputime_ticks_to_usecs(os_cputime_get32() - start);
+
+        console_printf("screen bench asset %d: %d frames in %lu us, %lu.%02lu fps\n",
+                       pics[i], n, (unsigned long) usecs,
+                       (unsigned long) (n * 100000000ULL / usecs / 100),
+                       (unsigned long) (n * 100000000ULL / usecs % 100));
+    }
+
+    screen_bench_shapes();
+}
+#endif
+
 /* LCD management task */
 void
 screen_task_handler(void *arg)
 {
-
-    hal_spi_disable(0);
-    hal_spi_config(0, &screen_SPI_settings);
-    hal_spi_enable(0);
-
+#if MYNEWT_VAL(SCREEN_BENCH)
+    uint32_t boot_start;
+#endif
+    int rc;
 
     /*  GPIO configuration. */
     g_led_pin = LED_BLINK_PIN;
@@ -286,36 +851,30 @@ screen_task_handler(void *arg)
     hal_gpio_init_out(pwm_lcd, 0);
     hal_gpio_init_out(nCS_MEM, 1);
 
+    /*
+    * The external memory is initialized by the flash task, together with
+    * SPI0 shared with the LCD: mode 3, 8 MHz, MSB first suits both.
+    */
+    while(my_sst26_dev == NULL){
+        os_time_delay(OS_TICKS_PER_SEC/10);
+    }
+    screen_flash_dev = my_sst26_dev;
+
+    rc = stats_init_and_reg(STATS_HDR(g_lcd_stats),
+                            STATS_SIZE_INIT_PARMS(g_lcd_stats, STATS_SIZE_32),
+                            STATS_NAME_INIT_PARMS(lcd_stats), "lcd");
+    assert(rc == 0);
+
+#if MYNEWT_VAL(SCREEN_BENCH)
+    boot_start = os_cputime_get32();
+#endif
     st7735_DisplayOff();
     BSP_LCD_Init();
     st7735_DisplayOn();
 
-    /*  Initialize sst26 driver for the external memory */
-    static const uint8_t SPI_SCK_PIN  = 16;
-    static const uint8_t SPI_MOSI_PIN = 17;
-    static const uint8_t SPI_MISO_PIN = 18;
-    static const uint8_t SPI_SS_PIN   = 20;
-  
-    struct nrf52_hal_spi_cfg spi_cfg = {
-        .sck_pin      = SPI_SCK_PIN ,
-        .mosi_pin     = SPI_MOSI_PIN,
-        .miso_pin     = SPI_MISO_PIN,
-        .ss_pin       = SPI_SS_PIN 
-    };
-
-    struct sst26_dev *my_sst26_dev = NULL;
-    
-    my_sst26_dev = sst26_default_config();
-    my_sst26_dev->spi_num = 0;
-    my_sst26_dev->spi_cfg = &spi_cfg;
-    my_sst26_dev->ss_pin = spi_cfg.ss_pin;
-
-    int rc;
-    rc = sst26_init((struct hal_flash *) my_sst26_dev);
-    if (rc) {
-        // XXX: error handling 
-    }
-
+#if MYNEWT_VAL(SCREEN_BENCH)
+    screen_bench(os_cputime_ticks_to_usecs(os_cputime_get32() - boot_start));
+#endif
 
     /*
     * Write picture in permanent memory 
@@ -348,7 +907,7 @@ screen_task_handler(void *arg)
     /* Init variable */
     static uint8_t boot_counter=0;
 
-    uint8_t ptr_clock[10];
+    uint8_t ptr_clock[21] = {0};
     uint32_t task_percent;
     uint32_t task_time = 0;
     uint8_t act_code[4]={0};
@@ -364,12 +923,15 @@ screen_task_handler(void *arg)
         */
         os_time_delay(OS_TICKS_PER_SEC);
 
+        /* What the BSP drew in the framebuffer, if there is one */
+        BSP_LCD_Flush();
+
         switch(todoo->which_state) {
             case boot :             
                 if(todoo->config_state){
                     //sst26_read((struct hal_flash *) my_sst26_dev, ADD_BRAND_PIC , &image_buf, N_BYTES_128x128_BMP);
                     //BSP_LCD_DrawBitmap(0,0,image_buf);
-                    ext_memory_bitmap_to_LCD(0 , 0,  ADD_BRAND_PIC, (struct hal_flash *) my_sst26_dev);
+                    asset_to_LCD(0, 0, TODOO_ASSET_BRAND_PIC);
                     todoo->config_state  = 0;
                 }
                 ++boot_counter;
@@ -384,7 +946,7 @@ screen_task_handler(void *arg)
                 if(todoo->config_state){
                     //sst26_read((struct hal_flash *) my_sst26_dev, ADD_ADV_REQ_PIC, &image_buf, N_BYTES_128x128_BMP);
                     //BSP_LCD_DrawBitmap(0,0,image_buf);
-                    ext_memory_bitmap_to_LCD(0 , 0,  ADD_ADV_REQ_PIC, (struct hal_flash *) my_sst26_dev);
+                    asset_to_LCD(0, 0, TODOO_ASSET_ADV_REQ_PIC);
                     todoo->config_state  = 0;
                 }
                 break;    
@@ -392,7 +954,9 @@ screen_task_handler(void *arg)
                 if(todoo->config_state){
                     todoo->config_state = 0;
 
-                    BSP_LCD_Clear(LCD_COLOR_WHITE);
+                    lcd_reset();
+                    BSP_LCD_SetTextColor(LCD_COLOR_WHITE);
+                    BSP_LCD_SetBackColor(LCD_COLOR_RED);
 
                     which_activity(todoo, &act_code[0]);
 
@@ -409,54 +973,55 @@ screen_task_handler(void *arg)
                         //sst26_read((struct hal_flash *) my_sst26_dev, ADD_FREE_TIME_PIC, &image_buf, N_BYTES_90x90_BMP);
                         //BSP_LCD_DrawBitmap(20,20,image_buf);
                         
-                        //ext_memory_bitmap_to_LCD(20 , 20,  ADD_FREE_TIME_PIC, (struct hal_flash *) my_sst26_dev);
+                        lcd_picture(20, 20, TODOO_ASSET_FREE_TIME_PIC);
                     }else{
                         // Show activity number in act_code[0]
                         //sst26_read((struct hal_flash *) my_sst26_dev, ADD_FREE_TIME_PIC, &image_buf, N_BYTES_90x90_BMP);
                         //BSP_LCD_DrawBitmap(20,20,image_buf);
 
-                        //ext_memory_bitmap_to_LCD(20 , 20,  ADD_FREE_TIME_PIC, (struct hal_flash *) my_sst26_dev);
+                        lcd_picture(20, 20, TODOO_ASSET_ACTIVITY(act_code[0]));
                     }
                     
                     task_time = current_task_time_calculation(todoo, act_code[0], act_code[1]);
                     current_task_time = current_task_time_spend_calculation(todoo, act_code[0], act_code[1]);
-
-                    initialize_screen_bar();
                 }
 
 
 
-                    BSP_LCD_DisplayChar(10, 0, todoo->parameters->time[B_HOUR]/10+48);
-                    BSP_LCD_DisplayChar(20, 0, todoo->parameters->time[B_HOUR]%10+48);
-                    BSP_LCD_DisplayChar(35, 0, todoo->parameters->time[B_MIN]/10+48);
-                    BSP_LCD_DisplayChar(45, 0, todoo->parameters->time[B_MIN]%10+48);
-                    BSP_LCD_DisplayChar(60, 0,todoo->parameters->time[B_SEC]/10+48);
-                    BSP_LCD_DisplayChar(70, 0,todoo->parameters->time[B_SEC]%10+48);
+                /* Only what changed is drawn, by lcd_flush() */
+                refresh_time_ptr(5 , current_task_time, &ptr_clock[0]);
+                task_percent = refresh_task_percent(current_task_time, task_time);
+                lcd_time_bar(task_percent);
+                BSP_LCD_SetFont(&Font12);
+
+                    lcd_char(10, 0, todoo->parameters->time[B_HOUR]/10+48);
+                    lcd_char(20, 0, todoo->parameters->time[B_HOUR]%10+48);
+                    lcd_char(35, 0, todoo->parameters->time[B_MIN]/10+48);
+                    lcd_char(45, 0, todoo->parameters->time[B_MIN]%10+48);
+                    lcd_char(60, 0,todoo->parameters->time[B_SEC]/10+48);
+                    lcd_char(70, 0,todoo->parameters->time[B_SEC]%10+48);
                     
-                    BSP_LCD_DisplayChar(100, 0,48+act_code[0]);
-                    BSP_LCD_DisplayChar(115, 0,48+act_code[1]);
+                    lcd_char(100, 0,48+act_code[0]);
+                    lcd_char(115, 0,48+act_code[1]);
 
-                    BSP_LCD_DisplayChar(10, 10, 48+todoo->parameters->day);
-                    BSP_LCD_DisplayChar(10, 20, 48+todoo->parameters->num_activity);
+                    lcd_char(10, 10, 48+todoo->parameters->day);
+                    lcd_char(10, 20, 48+todoo->parameters->num_activity);
                     int i_act;
                     for(i_act=0;i_act<todoo->parameters->num_activity;i_act++){
-                        BSP_LCD_DisplayChar(10+i_act*20, 40, 48+todoo->activity[i_act].day );
-                        BSP_LCD_DisplayChar(10+i_act*20, 50, todoo->activity[i_act].start_time[B_HOUR]/10+48);
-                        BSP_LCD_DisplayChar(15+i_act*20, 50, todoo->activity[i_act].start_time[B_HOUR]%10+48);
-                        BSP_LCD_DisplayChar(10+i_act*20, 60, todoo->activity[i_act].start_time[B_MIN]/10+48);
-                        BSP_LCD_DisplayChar(15+i_act*20, 60, todoo->activity[i_act].start_time[B_MIN]%10+48);
-                        BSP_LCD_DisplayChar(10+i_act*20, 70, todoo->activity[i_act].end_time[B_HOUR]/10+48);
-                        BSP_LCD_DisplayChar(15+i_act*20, 70, todoo->activity[i_act].end_time[B_HOUR]%10+48);
-                        BSP_LCD_DisplayChar(10+i_act*20, 80, todoo->activity[i_act].end_time[B_MIN]/10+48);
-                        BSP_LCD_DisplayChar(15+i_act*20, 80, todoo->activity[i_act].end_time[B_MIN]%10+48);
+                        lcd_char(10+i_act*20, 40, 48+todoo->activity[i_act].day );
+                        lcd_char(10+i_act*20, 50, todoo->activity[i_act].start_time[B_HOUR]/10+48);
+                        lcd_char(15+i_act*20, 50, todoo->activity[i_act].start_time[B_HOUR]%10+48);
+                        lcd_char(10+i_act*20, 60, todoo->activity[i_act].start_time[B_MIN]/10+48);
+                        lcd_char(15+i_act*20, 60, todoo->activity[i_act].start_time[B_MIN]%10+48);
+                        lcd_char(10+i_act*20, 70, todoo->activity[i_act].end_time[B_HOUR]/10+48);
+                        lcd_char(15+i_act*20, 70, todoo->activity[i_act].end_time[B_HOUR]%10+48);
+                        lcd_char(10+i_act*20, 80, todoo->activity[i_act].end_time[B_MIN]/10+48);
+                        lcd_char(15+i_act*20, 80, todoo->activity[i_act].end_time[B_MIN]%10+48);
                     }
 
-
-                refresh_time_ptr(5 , current_task_time, &ptr_clock[0]);
-                task_percent = refresh_task_percent(current_task_time, task_time);
-                draw_time_bar(task_percent);
-                BSP_LCD_SetFont(&Font12);
-                BSP_LCD_DisplayStringAtLine(9, &ptr_clock[0]);
+                lcd_string_line(9, &ptr_clock[0]);
+                lcd_flush();
+                STATS_INC(g_lcd_stats, frames);
                 
                 if(current_task_time == 0){
                     todoo->config_state = 1;
@@ -473,27 +1038,200 @@ screen_task_handler(void *arg)
 }
 
 //////////////////////////////* LCD IO functions *//////////////////
+/*
+* The LCD is selected by the first write and let go by the end of it, or by
+* LCD_IO_End() when writes are batched: commands and data then follow each
+* other under one chip select, only DC changes. The bus is held all along,
+* the external memory must not be used in a batch.
+*/
+static uint32_t lcd_io_depth;
+static uint8_t lcd_io_selected;
+
+static void lcd_select(uint8_t data){
+
+    lcd_bus_acquire();
+
+    if(!lcd_io_selected){
+        /* Reset LCD control line CS */
+        hal_gpio_write(ncs_lcd, 0);
+        lcd_io_selected = 1;
+
+        STATS_INC(g_lcd_stats, selects);
+    }
+
+    /* Set LCD data/command line DC, high for data */
+    hal_gpio_write(dc_lcd, data);
+}
+
+static void lcd_deselect(void){
+
+    if(lcd_io_depth == 0 && lcd_io_selected){
+        /* Deselect : Chip Select high */
+        hal_gpio_write(ncs_lcd, 1);
+        lcd_io_selected = 0;
+    }
+
+    lcd_bus_release();
+}
+
+void LCD_IO_Begin(void){
+
+    lcd_bus_acquire();
+    lcd_io_depth++;
+}
+
+void LCD_IO_End(void){
+
+    lcd_io_depth--;
+    lcd_deselect();
+}
+
+/*
+* Send pixels already in the LCD byte order to the open window in a single
+* transfer. The buffer is received over.
+*/
+static void lcd_write_pixels(uint8_t *buf, uint32_t len){
+
+    lcd_select(1);
+
+    hal_spi_txrx(0, buf, buf, len);
+
+    lcd_deselect();
+
+    STATS_INCN(g_lcd_stats, tx_bytes, len);
+}
+
+/*
+* Decoder of the compressed pixels, fed with the chunks read from flash.
+* RLE565 runs and pixels can span two chunks, the decoded pixels gather in
+* lcd_buf.
+*/
+struct lcd_decoder {
+    uint8_t lit;            /* Literal pixels left */
+    uint8_t rep;            /* Times to repeat the next pixel */
+    uint8_t hi;             /* First byte of the pending pixel */
+    uint8_t have_hi;
+    uint32_t pixels;        /* Pixels left, palette indexes end padded */
+    uint32_t fill;          /* Bytes in lcd_buf */
+};
+
+static void lcd_put_pixel(struct lcd_decoder *dec, uint8_t hi, uint8_t lo){
+    lcd_buf[dec->fill++] = hi;
+    lcd_buf[dec->fill++] = lo;
+    if(dec->fill == sizeof(lcd_buf)){
+        lcd_write_pixels(lcd_buf, dec->fill);
+        dec->fill = 0;
+    }
+}
+
+static void rle_decode(struct lcd_decoder *dec, const uint8_t *in, uint32_t len){
+    uint32_t i;
+
+    for(i=0;i<len;i++){
+        if(dec->lit == 0 && dec->rep == 0){
+            if(in[i] < 128){
+                dec->lit = in[i] + 1;
+            }else{
+                dec->rep = in[i] - 126;
+            }
+            continue;
+        }
+        if(!dec->have_hi){
+            dec->hi = in[i];
+            dec->have_hi = 1;
+            continue;
+        }
+        dec->have_hi = 0;
+
+        if(dec->lit){
+            lcd_put_pixel(dec, dec->hi, in[i]);
+            dec->lit--;
+        }else{
+            while(dec->rep){
+                lcd_put_pixel(dec, dec->hi, in[i]);
+                dec->rep--;
+            }
+        }
+    }
+}
+
+/*
+* Expand palette indexes of bpp bits through lcd_lut.
+*/
+static void pal_decode(struct lcd_decoder *dec, const uint8_t *in, uint32_t len,
+                       uint8_t bpp){
+    uint32_t i;
+    uint8_t shift, idx, mask;
+
+    mask = (1 << bpp) - 1;
+    for(i=0;i<len;i++){
+        for(shift=8;shift>0 && dec->pixels;dec->pixels--){
+            shift -= bpp;
+            idx = (in[i] >> shift) & mask;
+            lcd_put_pixel(dec, lcd_lut[idx][0], lcd_lut[idx][1]);
+        }
+    }
+}
+
 void ext_memory_bitmap_to_LCD(uint16_t Xpos, uint16_t Ypos,  uint32_t addr, const struct hal_flash * sst26_dev){
 
         /*Send the data by SPI1 (could be adapted by changing the hspiX)*/
-        uint32_t j=0;
+        uint32_t j=0, k=0;
+        uint32_t chunk = 0;
         uint32_t height = 0, width  = 0;
         uint32_t index = 0, size = 0;
+        uint8_t tmp, format;
+        struct sst26_stream stream;
+        struct todoo_image_hdr hdr;
+        struct lcd_decoder dec;
 
         /* Image buffer */
         unsigned char pbmp[100];
                 
         /* Read a set of bytes */
         sst26_read((struct hal_flash *) sst26_dev, addr, &pbmp[0], 100);
-        
-        /* Read bitmap width */
-        width = *(uint16_t *) (pbmp + 18);
-        width |= (*(uint16_t *) (pbmp + 20)) << 16;
-        
-        /* Read bitmap height */
-        height = *(uint16_t *) (pbmp + 22);
-        height |= (*(uint16_t *) (pbmp + 24)) << 16;
-        
+        memcpy(&hdr, pbmp, sizeof(hdr));
+
+        if(hdr.magic == TODOO_IMAGE_MAGIC){
+            /* Todoo image, size is the number of bytes stored */
+            width = hdr.width;
+            height = hdr.height;
+            index = hdr.hdr_len;
+            size = hdr.len;
+            format = hdr.format;
+            switch(format){
+            case TODOO_IMAGE_RGB565_BE:
+            case TODOO_IMAGE_RLE565:
+                break;
+            case TODOO_IMAGE_PAL1:
+            case TODOO_IMAGE_PAL2:
+            case TODOO_IMAGE_PAL4:
+            case TODOO_IMAGE_PAL8:
+                if(hdr.colors > 256){
+                    return;
+                }
+                break;
+            default:
+                return;
+            }
+        }else{
+            /* Read bitmap width */
+            width = *(uint16_t *) (pbmp + 18);
+            width |= (*(uint16_t *) (pbmp + 20)) << 16;
+
+            /* Read bitmap height */
+            height = *(uint16_t *) (pbmp + 22);
+            height |= (*(uint16_t *) (pbmp + 24)) << 16;
+
+            /* Read bitmap size */
+            size = *(volatile uint16_t *) (pbmp + 2);
+            size |= (*(volatile uint16_t *) (pbmp + 4)) << 16;
+            /* Get bitmap data address offset */
+            index = *(volatile uint16_t *) (pbmp + 10);
+            index |= (*(volatile uint16_t *) (pbmp + 12)) << 16;
+            size = size - index;
+            format = 0;
+        }
         
         /* Remap Ypos, st7735 works with inverted X in case of bitmap */
         /* X = 0, cursor is on Top corner */
@@ -502,15 +1240,6 @@ void ext_memory_bitmap_to_LCD(uint16_t Xpos, uint16_t Ypos,  uint32_t addr, cons
         
         st7735_SetDisplayWindow(Xpos, Ypos, width, height);
         
-        /* Read bitmap size */
-        size = *(volatile uint16_t *) (pbmp + 2);
-        size |= (*(volatile uint16_t *) (pbmp + 4)) << 16;
-        /* Get bitmap data address offset */
-        index = *(volatile uint16_t *) (pbmp + 10);
-        index |= (*(volatile uint16_t *) (pbmp + 12)) << 16;
-        size = (size - index)/2;
-        //pbmp += index;
-        
         /* Set GRAM write direction and BGR = 0 */
         /* Memory access control: MY = 0, MX = 1, MV = 0, ML = 0 */
         st7735_WriteReg(LCD_REG_54, 0x48);
@@ -518,27 +1247,67 @@ void ext_memory_bitmap_to_LCD(uint16_t Xpos, uint16_t Ypos,  uint32_t addr, cons
         /* Set Cursor */
         st7735_SetCursor(Xpos, Ypos);  
     
-        /* Set LCD data/command line DC to high */
-        hal_gpio_write(dc_lcd, 1);
-        
-    
-        /* Send Command */
-        /* While the SPI in TransmitReceive process, user can transmit data through
-             "pData" buffer */
-    
-        for(j=0;j<size*2;j+=2){                
-            sst26_read((struct hal_flash *) sst26_dev, j+addr+index, &pbmp[0], 2);
+        /*
+        * The picture is pulled from a flash stream one chunk at a time and
+        * sent to the LCD in a single transfer under one chip select: BMP
+        * pixels swapped in place to the high byte first order of the LCD,
+        * RLE565 and palette ones decoded in lcd_buf. The bus is given back
+        * between chunks, which suspends the stream.
+        */
+        if(sst26_stream_open((struct sst26_dev *) sst26_dev, &stream, addr+index)){
+            return;
+        }
 
-        /* Reset LCD control line CS */
-        hal_gpio_write(ncs_lcd, 0);
+        memset(&dec, 0, sizeof(dec));
+        dec.pixels = width * height;
 
-            hal_spi_txrx(0, &pbmp[1], rxbuf, 1);
-            hal_spi_txrx(0, &pbmp[0], rxbuf, 1);
+        j = 0;
+        if(TODOO_IMAGE_IS_PAL(format)){
+            j = hdr.colors * 2;
+            if(sst26_stream_read(&stream, &lcd_lut[0][0], j)){
+                size = 0;
+            }
+        }
 
-        /* Deselect : Chip Select high */
-        hal_gpio_write(ncs_lcd, 1);
+        for(;j<size;j+=chunk){
+            chunk = size - j;
+            if(chunk > sizeof(image_buf)){
+                chunk = sizeof(image_buf);
+            }
+            if(sst26_stream_read(&stream, &image_buf[0], chunk)){
+                break;
+            }
+
+            switch(format){
+            case TODOO_IMAGE_RLE565:
+                rle_decode(&dec, &image_buf[0], chunk);
+                break;
+            case TODOO_IMAGE_RGB565_BE:
+                lcd_write_pixels(&image_buf[0], chunk);
+                break;
+            case TODOO_IMAGE_PAL1:
+            case TODOO_IMAGE_PAL2:
+            case TODOO_IMAGE_PAL4:
+            case TODOO_IMAGE_PAL8:
+                pal_decode(&dec, &image_buf[0], chunk, TODOO_IMAGE_PAL_BPP(format));
+                break;
+            default:
+                for(k=0;k<chunk;k+=2){
+                    tmp = image_buf[k];
+                    image_buf[k] = image_buf[k+1];
+                    image_buf[k+1] = tmp;
+                }
+                lcd_write_pixels(&image_buf[0], chunk);
+                break;
+            }
         }
-    
+
+        if(dec.fill){
+            lcd_write_pixels(lcd_buf, dec.fill);
+        }
+
+        sst26_stream_close(&stream);
+        BSP_LCD_Invalidate();
 
 }
 
@@ -572,60 +1341,89 @@ void send_8bit_serial(uint8_t *Data)
    }
 }
 
+/*
+* Data with the bytes of each pair swapped goes through two staging
+* buffers: one is filled while the other is sent in the background
+* (EasyDMA), lcd_stage_sem is given back at the end of each transfer.
+* The SPI callback belongs to the external memory driver, which passes
+* the completion on to the holder of the bus.
+*/
+#define LCD_STAGE_SIZE  128
+
+static uint8_t lcd_stage[2][LCD_STAGE_SIZE];
+static struct os_sem lcd_stage_sem;
+
+static void lcd_stage_done(void *arg, int len){
+
+    os_sem_release(&lcd_stage_sem);
+}
+
 void LCD_IO_Init(void){
 	
+	os_sem_init(&lcd_stage_sem, 0);
 	hal_gpio_write(pwm_lcd, 1);
 	/* LCD chip select high */
 	hal_gpio_write(ncs_lcd, 1); //LCD_CS_HIGH();
 }
 void LCD_IO_WriteMultipleData(uint8_t *pData, uint32_t pData_numb){
-	/*Send the data by SPI1 (could be adapted by changing the hspiX)*/
-    uint32_t j=0;
-    
-	/* Reset LCD control line CS */
-	hal_gpio_write(ncs_lcd, 0);
+    uint32_t j, k, chunk;
+    uint8_t *stage;
+    int cur = 0, busy = 0;
 
-	/* Set LCD data/command line DC to high */
-    hal_gpio_write(dc_lcd, 1);
-
-	/* Send Command */
-	/* While the SPI in TransmitReceive process, user can transmit data through
-         "pData" buffer */
+    lcd_select(1);
 
     if(pData_numb==1){
-        //send_8bit_serial(pData);
         hal_spi_txrx(0, pData, rxbuf, 1);
     }
     else{
-        for(j=0;j<pData_numb;j+=2){
-            //send_8bit_serial(pData+j+1);
-            //send_8bit_serial(pData+j);
-            hal_spi_txrx(0, pData+j+1, rxbuf, 1);
-            hal_spi_txrx(0, pData+j, rxbuf, 1);
+        for(j=0;j<pData_numb;j+=chunk){
+            chunk = pData_numb - j < LCD_STAGE_SIZE ? pData_numb - j : LCD_STAGE_SIZE;
+            stage = lcd_stage[cur];
+            for(k=0;k+1<chunk;k+=2){
+                stage[k] = pData[j+k+1];
+                stage[k+1] = pData[j+k];
+            }
+            if(k<chunk){
+                stage[k] = pData[j+k];
+            }
+
+            /* The other buffer must be on its way before this one goes */
+            if(busy){
+                os_sem_pend(&lcd_stage_sem, OS_TIMEOUT_NEVER);
+            }
+            busy = screen_flash_dev &&
+                   sst26_bus_txrx_noblock(screen_flash_dev, stage, stage, chunk,
+                                          lcd_stage_done, NULL) == 0;
+            if(!busy){
+                hal_spi_txrx(0, stage, stage, chunk);
+            }
+            cur ^= 1;
+        }
+        if(busy){
+            os_sem_pend(&lcd_stage_sem, OS_TIMEOUT_NEVER);
         }
     }
 
+    lcd_deselect();
+
+    STATS_INCN(g_lcd_stats, tx_bytes, pData_numb);
+}
+/*
+* Pixels already high byte first, sent at once. Used by the framebuffer.
+*/
+void LCD_IO_WritePixels(uint8_t *pData, uint32_t pData_numb){
 
-	/* Deselect : Chip Select high */
-	hal_gpio_write(ncs_lcd, 1);
+    lcd_write_pixels(pData, pData_numb);
 }
 void LCD_IO_WriteReg(uint8_t Reg){
-	/*Send the register address by SPI1 (could be adapted by changing the hspiX)*/
 
-	/* Reset LCD control line CS */
-	hal_gpio_write(ncs_lcd, 0);
+    lcd_select(0);
 
-	/* Set LCD data/command line DC to Low */
-	hal_gpio_write(dc_lcd, 0);
+    hal_spi_txrx(0, &Reg, rxbuf, 1);
 
-	/* Send Command */
-	/* While the SPI in TransmitReceive process, user can transmit data through
-	     "Reg" buffer*/
-        //send_8bit_serial(&Reg);
-        hal_spi_txrx(0, &Reg, rxbuf, 1);
+    lcd_deselect();
 
-	/* Deselect : Chip Select high */
-	hal_gpio_write(ncs_lcd, 1);
+    STATS_INC(g_lcd_stats, tx_bytes);
 }
 void LCD_Delay(uint32_t delay){
     
@@ -642,8 +1440,6 @@ void LCD_Delay(uint32_t delay){
   void BSP_LCD_FillLoading(uint16_t Xpos, uint16_t Ypos, Orientation Orient)
   {  
     uint8_t  i; 
-    uint8_t Length_LUT[20] = {11,10,9,8,7,6,6,5,5,5,5,5,5,6,6,7,8,9,10,11};
-    uint8_t CoinLength_LUT[20] = {20,18,16,14,12,11,9,8,7,6,4,4,3,2,1,1,0,0,0,0};
     
     //BSP_LCD_SetTextColor(DrawProp.TextColor);
     
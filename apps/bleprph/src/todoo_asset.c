@@ -0,0 +1,270 @@
+/*
+ * CHIC - China Hardware Innovation Camp - Todoo
+ * https://chi.camp/projects/todoo/
+ *
+ * Directory of the assets of the external memory (see todoo_asset.h).
+ *
+ * The directory is loaded and appended by the flash task, the other tasks
+ * only take assets once it published the external memory device. The lock
+ * covers the RAM index and the images they hold.
+*/
+
+#include <string.h>
+
+#include "syscfg/syscfg.h"
+#include "os/os.h"
+
+#include "todoo_asset.h"
+#include "todoo_image.h"
+
+#define TODOO_ASSET_SLOTS   (TODOO_ASSET_DIR_SIZE / sizeof(struct todoo_asset))
+
+static struct sst26_dev *todoo_asset_dev;
+
+/* RAM index of the directory, by id */
+static struct todoo_asset todoo_assets[MYNEWT_VAL(TODOO_ASSET_MAX)];
+
+/* Address of the images held by the other tasks, 0 in a free pin */
+static uint32_t todoo_asset_pins[TODOO_ASSET_PINS];
+static struct os_mutex todoo_asset_lock;
+
+/* Sector of the directory, its sequence number and first erased slot */
+static uint32_t todoo_asset_dir;
+static uint32_t todoo_asset_seq;
+static uint32_t todoo_asset_slot;
+
+static int todoo_asset_write_slot(const struct todoo_asset *asset){
+
+    /* The slot is erased, this only programs it */
+    return sst26_write((struct hal_flash *) todoo_asset_dev,
+                       todoo_asset_dir + todoo_asset_slot * sizeof(*asset),
+                       asset, sizeof(*asset));
+}
+
+/*
+* Load the entries of the directory sector in the RAM index.
+*/
+static int todoo_asset_load(void){
+    struct sst26_stream stream;
+    struct todoo_asset asset;
+    int rc;
+
+    if(sst26_stream_open(todoo_asset_dev, &stream, todoo_asset_dir)){
+        return -1;
+    }
+
+    rc = 0;
+    todoo_asset_slot = 0;
+    while(todoo_asset_slot < TODOO_ASSET_SLOTS){
+        if(sst26_stream_read(&stream, &asset, sizeof(asset))){
+            rc = -1;
+            break;
+        }
+        if(asset.id == 0xffff){
+            break;
+        }
+        if(asset.id < MYNEWT_VAL(TODOO_ASSET_MAX)){
+            todoo_assets[asset.id] = asset;
+        }
+        todoo_asset_slot++;
+    }
+
+    sst26_stream_close(&stream);
+
+    return rc;
+}
+
+/*
+* Write the RAM index in the other directory sector, header last, so that
+* the current one stays valid until it's complete.
+*/
+static int todoo_asset_compact(void){
+    struct todoo_asset hdr;
+    uint32_t i;
+
+    todoo_asset_dir = todoo_asset_dir == TODOO_ASSET_DIR_ADDR ?
+                      TODOO_ASSET_DIR_ADDR + TODOO_ASSET_DIR_SIZE :
+                      TODOO_ASSET_DIR_ADDR;
+    todoo_asset_seq++;
+
+    if(sst26_sector_erase((struct hal_flash *) todoo_asset_dev, todoo_asset_dir)){
+        return -1;
+    }
+
+    todoo_asset_slot = 1;
+    for(i=0;i<MYNEWT_VAL(TODOO_ASSET_MAX);i++){
+        if(todoo_assets[i].id != i){
+            continue;
+        }
+        if(todoo_asset_write_slot(&todoo_assets[i])){
+            return -1;
+        }
+        todoo_asset_slot++;
+    }
+
+    memset(&hdr, 0xff, sizeof(hdr));
+    hdr.id = TODOO_ASSET_DIR_HDR;
+    hdr.addr = todoo_asset_seq;
+
+    i = todoo_asset_slot;
+    todoo_asset_slot = 0;
+    if(todoo_asset_write_slot(&hdr)){
+        return -1;
+    }
+    todoo_asset_slot = i;
+
+    return 0;
+}
+
+/*
+* Load the directory of the external memory in the RAM index.
+*/
+int todoo_asset_init(struct sst26_dev *dev){
+    struct todoo_asset hdr;
+    uint32_t i, addr;
+
+    todoo_asset_dev = dev;
+    memset(todoo_assets, 0xff, sizeof(todoo_assets));
+    memset(todoo_asset_pins, 0, sizeof(todoo_asset_pins));
+    os_mutex_init(&todoo_asset_lock);
+
+    todoo_asset_dir = TODOO_ASSET_DIR_ADDR;
+    todoo_asset_seq = 0;
+    for(i=0;i<TODOO_ASSET_DIR_COUNT;i++){
+        addr = TODOO_ASSET_DIR_ADDR + i * TODOO_ASSET_DIR_SIZE;
+        if(sst26_read((struct hal_flash *) dev, addr, &hdr, sizeof(hdr))){
+            return -1;
+        }
+        if(hdr.id == TODOO_ASSET_DIR_HDR && hdr.addr > todoo_asset_seq){
+            todoo_asset_dir = addr;
+            todoo_asset_seq = hdr.addr;
+        }
+    }
+
+    return todoo_asset_load();
+}
+
+/*
+* Asset of the given id, NULL if there is none. For the flash task, the
+* entry changes with the directory.
+*/
+const struct todoo_asset *todoo_asset_find(uint16_t id){
+
+    if(id >= MYNEWT_VAL(TODOO_ASSET_MAX) || todoo_assets[id].id != id){
+        return NULL;
+    }
+    return &todoo_assets[id];
+}
+
+/*
+* Copy the asset of the given id and keep its image from being reclaimed
+* until todoo_asset_put(). -1 if there is none or too many are held.
+*/
+int todoo_asset_get(uint16_t id, struct todoo_asset *asset){
+    const struct todoo_asset *found;
+    uint32_t i;
+    int rc;
+
+    rc = -1;
+    os_mutex_pend(&todoo_asset_lock, OS_TIMEOUT_NEVER);
+    found = todoo_asset_find(id);
+    for(i=0;found && i<TODOO_ASSET_PINS;i++){
+        if(todoo_asset_pins[i] == 0){
+            todoo_asset_pins[i] = found->addr;
+            *asset = *found;
+            rc = 0;
+            break;
+        }
+    }
+    os_mutex_release(&todoo_asset_lock);
+
+    return rc;
+}
+
+/*
+* Give back an asset taken with todoo_asset_get().
+*/
+void todoo_asset_put(const struct todoo_asset *asset){
+    uint32_t i;
+
+    os_mutex_pend(&todoo_asset_lock, OS_TIMEOUT_NEVER);
+    for(i=0;i<TODOO_ASSET_PINS;i++){
+        if(todoo_asset_pins[i] == asset->addr){
+            todoo_asset_pins[i] = 0;
+            break;
+        }
+    }
+    os_mutex_release(&todoo_asset_lock);
+}
+
+/*
+* Whether an asset lies in [start, end), 1, or only an image held by
+* another task, TODOO_ASSET_HELD. 0 if neither.
+*/
+int todoo_asset_in_use(uint32_t start, uint32_t end){
+    uint32_t i;
+    int rc;
+
+    rc = 0;
+    os_mutex_pend(&todoo_asset_lock, OS_TIMEOUT_NEVER);
+    for(i=0;i<MYNEWT_VAL(TODOO_ASSET_MAX) && !rc;i++){
+        rc = todoo_assets[i].id == i &&
+             todoo_assets[i].addr >= start && todoo_assets[i].addr < end;
+    }
+    for(i=0;i<TODOO_ASSET_PINS && !rc;i++){
+        if(todoo_asset_pins[i] >= start && todoo_asset_pins[i] < end){
+            rc = TODOO_ASSET_HELD;
+        }
+    }
+    os_mutex_release(&todoo_asset_lock);
+
+    return rc;
+}
+
+/*
+* Register the Todoo image at addr as asset id, in place of any previous
+* one. -1 if there is no image there or the directory can't be written.
+*/
+int todoo_asset_add(uint16_t id, uint32_t addr){
+    struct todoo_image_hdr hdr;
+    struct todoo_asset asset;
+
+    if(id >= MYNEWT_VAL(TODOO_ASSET_MAX)){
+        return -1;
+    }
+    if(todoo_image_read_hdr(todoo_asset_dev, addr, &hdr)){
+        return -1;
+    }
+
+    memset(&asset, 0xff, sizeof(asset));
+    asset.id = id;
+    asset.format = hdr.format;
+    asset.addr = addr;
+    asset.len = hdr.hdr_len + hdr.len;
+    asset.crc = hdr.crc;
+
+    if(todoo_asset_slot >= TODOO_ASSET_SLOTS && todoo_asset_compact()){
+        return -1;
+    }
+    if(todoo_asset_slot >= TODOO_ASSET_SLOTS){
+        return -1;
+    }
+
+    if(todoo_asset_write_slot(&asset)){
+        return -1;
+    }
+    todoo_asset_slot++;
+
+    os_mutex_pend(&todoo_asset_lock, OS_TIMEOUT_NEVER);
+    todoo_assets[id] = asset;
+    os_mutex_release(&todoo_asset_lock);
+
+    return 0;
+}
+
+/*
+* Entries written in the directory.
+*/
+int todoo_asset_count(void){
+    return todoo_asset_slot;
+}
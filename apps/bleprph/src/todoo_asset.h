@@ -0,0 +1,66 @@
+/*
+ * CHIC - China Hardware Innovation Camp - Todoo
+ * https://chi.camp/projects/todoo/
+ *
+ * Directory of the assets of the external memory.
+ *
+ * The first sector of the external memory lists the assets (pictures) by
+ * id, one 16 bytes entry each, appended in the first erased slot. A later
+ * entry of the same id replaces the earlier ones. The directory is loaded
+ * once in a RAM index, addressed by id.
+ *
+ * Once full, the index is written compacted to the second sector, behind
+ * a header entry holding a sequence number: the directory is the sector
+ * with the highest one, or the first sector if neither has a header.
+ *
+ * The flash task writes the directory and reclaims the images no asset
+ * points to. The other tasks take an asset with todoo_asset_get(), its
+ * image is kept until they give it back with todoo_asset_put().
+*/
+
+#ifndef TODOO_ASSET_H_INCLUDED
+#define TODOO_ASSET_H_INCLUDED
+
+#include <stdint.h>
+#include <SST26/SST26.h>
+
+#define TODOO_ASSET_DIR_ADDR        (0x000000)
+#define TODOO_ASSET_DIR_SIZE        (0x1000)
+#define TODOO_ASSET_DIR_COUNT       2
+
+/* Id of the directory header, its addr is the sequence number */
+#define TODOO_ASSET_DIR_HDR         0xfffe
+
+/* Asset ids */
+#define TODOO_ASSET_TEST_PIC        0
+#define TODOO_ASSET_ADV_REQ_PIC     1
+#define TODOO_ASSET_SHARING_PIC     2
+#define TODOO_ASSET_FREE_TIME_PIC   3
+#define TODOO_ASSET_BRAND_PIC       4
+#define TODOO_ASSET_ACTIVITY(i)     (8 + (i))
+
+struct todoo_asset {
+    uint16_t id;            /* 0xffff in an erased slot */
+    uint8_t  format;        /* Of the Todoo image, see todoo_image.h */
+    uint8_t  reserved;
+    uint32_t addr;          /* Of the Todoo image header */
+    uint32_t len;           /* Header included */
+    uint16_t crc;           /* Of the image pixels */
+    uint16_t reserved2;
+};
+
+/* Images taken by the other tasks at once */
+#define TODOO_ASSET_PINS            4
+
+/* todoo_asset_in_use() of an image no asset points to anymore */
+#define TODOO_ASSET_HELD            2
+
+int todoo_asset_init(struct sst26_dev *dev);
+const struct todoo_asset *todoo_asset_find(uint16_t id);
+int todoo_asset_get(uint16_t id, struct todoo_asset *asset);
+void todoo_asset_put(const struct todoo_asset *asset);
+int todoo_asset_in_use(uint32_t start, uint32_t end);
+int todoo_asset_add(uint16_t id, uint32_t addr);
+int todoo_asset_count(void);
+
+#endif
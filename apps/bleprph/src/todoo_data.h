@@ -26,6 +26,7 @@
 #define N_BYTES_TIME 3 // Hour, minute, second
 
 #define MAX_ACTIVITY 256  // MAX_ACTIVITY on 8 bits (0-255)
+#define MAX_ACTIVITY_SCHEDULE 24  // Activities the first packet has room for
 #define N_BYTES_PICTURE 16200   // picture 90px90p 2B/p
 #define N_BYTES_128x128_BMP 32834
 #define N_BYTES_90x90_BMP   16266
@@ -34,13 +35,15 @@
 #define B_MIN   1
 #define B_HOUR  0
 
-// Address of fix images in external SPI flash memory
+// Address the fix images are provisioned at in external SPI flash memory,
+// they are then found through the asset directory (see todoo_asset.h)
 #define ADD_TEST_PIC        (0x010000)
 #define ADD_ADV_REQ_PIC     (0x018042)
 #define ADD_SHARING_PIC     (0x020084)
 #define ADD_FREE_TIME_PIC   (0x0280C6)
 #define ADD_BRAND_PIC       (0x030108)
 
+// Activity pictures, 90x90 pixels without a BMP header, one after the other
 #define ADD_FIRST_ACTIVITY_PIC    (0x03814A)
 #define NUM_BYTE_ACTIVITY_PIC     (0x3F48)
 
@@ -77,6 +80,7 @@ struct Todoo_data{
     struct Activity   *activity;
     STATE which_state;
     uint8_t config_state;
+    uint8_t schedule;   // Changed with each schedule received
 };
 
 
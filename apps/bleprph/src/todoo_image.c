@@ -0,0 +1,471 @@
+/*
+ * CHIC - China Hardware Innovation Camp - Todoo
+ * https://chi.camp/projects/todoo/
+ *
+ * Todoo images in the external memory (see todoo_image.h).
+ *
+ * The helpers use a static buffer and are meant to be called from the
+ * flash task only.
+*/
+
+#include <string.h>
+
+#include "os/os.h"
+#include "crc/crc16.h"
+
+#include "todoo_image.h"
+#include "todoo_asset.h"
+#include "todoo_store.h"
+
+/* Widest picture the LCD can show */
+#define TODOO_IMAGE_MAX_SIZE    128
+
+/* Whole rows of pixels are converted and written at once */
+static uint8_t todoo_image_buf[1024];
+
+/* Row of the BMP file, padding included */
+static uint8_t todoo_image_row[TODOO_IMAGE_MAX_SIZE * 2 + 4];
+
+/* Colours of the picture being converted */
+static uint16_t todoo_image_pal[256];
+static uint32_t todoo_image_colors;
+
+/* BMP file being converted */
+struct todoo_bmp {
+    uint32_t addr;
+    uint32_t index;         /* Offset of the pixels */
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;        /* Bytes per row */
+};
+
+static uint32_t bmp_get32(const uint8_t *p){
+    return p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/*
+* Read the header of the Todoo image at addr, -1 if there is none.
+*/
+int todoo_image_read_hdr(struct sst26_dev *dev, uint32_t addr,
+                         struct todoo_image_hdr *hdr){
+
+    if(sst26_read((struct hal_flash *) dev, addr, hdr, sizeof(*hdr))){
+        return -1;
+    }
+    if(hdr->magic != TODOO_IMAGE_MAGIC ||
+       hdr->hdr_len < sizeof(*hdr)){
+        return -1;
+    }
+    switch(hdr->format){
+    case TODOO_IMAGE_RGB565_BE:
+        if(hdr->len != (uint32_t) hdr->width * hdr->height * 2){
+            return -1;
+        }
+        return 0;
+    case TODOO_IMAGE_RLE565:
+        return hdr->len ? 0 : -1;
+    case TODOO_IMAGE_PAL1:
+    case TODOO_IMAGE_PAL2:
+    case TODOO_IMAGE_PAL4:
+    case TODOO_IMAGE_PAL8:
+        if(hdr->colors == 0 ||
+           hdr->colors > (1 << TODOO_IMAGE_PAL_BPP(hdr->format)) ||
+           hdr->len != hdr->colors * 2 +
+           ((uint32_t) hdr->width * hdr->height *
+            TODOO_IMAGE_PAL_BPP(hdr->format) + 7) / 8){
+            return -1;
+        }
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/*
+* Check the pixels of the image at addr against the CRC of its header.
+*/
+int todoo_image_check(struct sst26_dev *dev, uint32_t addr,
+                      const struct todoo_image_hdr *hdr){
+    struct sst26_stream stream;
+    uint32_t i, chunk;
+    uint16_t crc;
+    int rc;
+
+    if(sst26_stream_open(dev, &stream, addr + hdr->hdr_len)){
+        return -1;
+    }
+
+    rc = 0;
+    crc = CRC16_INITIAL_CRC;
+    for(i=0;i<hdr->len;i+=chunk){
+        chunk = hdr->len - i;
+        if(chunk > sizeof(todoo_image_buf)){
+            chunk = sizeof(todoo_image_buf);
+        }
+        if(sst26_stream_read(&stream, todoo_image_buf, chunk)){
+            rc = -1;
+            break;
+        }
+        crc = crc16_ccitt(crc, todoo_image_buf, chunk);
+    }
+
+    sst26_stream_close(&stream);
+
+    if(rc == 0 && crc != hdr->crc){
+        rc = -1;
+    }
+    return rc;
+}
+
+/*
+* Encode a row of width big-endian RGB565 pixels to RLE565 in out, at most
+* 2 * width + (width + 127) / 128 bytes. With out NULL only the size of
+* the result is returned.
+*/
+uint32_t todoo_image_rle_row(const uint8_t *px, uint32_t width, uint8_t *out){
+    uint32_t i, n, run;
+
+    n = 0;
+    i = 0;
+    while(i < width){
+        /* Repeated pixel */
+        run = 1;
+        while(i + run < width && run < 129 &&
+              !memcmp(px + 2 * i, px + 2 * (i + run), 2)){
+            run++;
+        }
+        if(run > 1){
+            if(out){
+                out[n] = run + 126;
+                out[n+1] = px[2*i];
+                out[n+2] = px[2*i+1];
+            }
+            n += 3;
+            i += run;
+            continue;
+        }
+
+        /* Literal pixels up to the next repeat */
+        while(i + run < width && run < 128 &&
+              (i + run + 1 == width ||
+               memcmp(px + 2 * (i + run), px + 2 * (i + run + 1), 2))){
+            run++;
+        }
+        if(out){
+            out[n] = run - 1;
+            memcpy(out + n + 1, px + 2 * i, 2 * run);
+        }
+        n += 1 + 2 * run;
+        i += run;
+    }
+
+    return n;
+}
+
+/*
+* Read a row of the BMP file in todoo_image_row, swapped to the LCD order.
+*/
+static int todoo_image_bmp_row(struct sst26_dev *dev,
+                               const struct todoo_bmp *bmp, uint32_t row){
+    uint32_t k;
+    uint8_t tmp;
+
+    if(sst26_read((struct hal_flash *) dev, bmp->addr + bmp->index +
+                  row * bmp->stride, todoo_image_row, bmp->stride)){
+        return -1;
+    }
+
+    /* Little endian in the file, high byte first for the LCD */
+    for(k=0;k<bmp->width*2;k+=2){
+        tmp = todoo_image_row[k];
+        todoo_image_row[k] = todoo_image_row[k+1];
+        todoo_image_row[k+1] = tmp;
+    }
+    return 0;
+}
+
+/*
+* Index of the colour of px in todoo_image_pal, todoo_image_colors if it
+* isn't there.
+*/
+static uint32_t todoo_image_pal_index(const uint8_t *px){
+    static uint32_t last;
+    uint16_t color;
+    uint32_t i;
+
+    color = (px[0] << 8) | px[1];
+
+    /* Neighbours mostly share their colour */
+    if(last < todoo_image_colors && todoo_image_pal[last] == color){
+        return last;
+    }
+    for(i=0;i<todoo_image_colors;i++){
+        if(todoo_image_pal[i] == color){
+            last = i;
+            return i;
+        }
+    }
+    return i;
+}
+
+/*
+* Gather the colours of the picture in todoo_image_pal, -1 if there are
+* more than 256.
+*/
+static int todoo_image_bmp_palette(struct sst26_dev *dev,
+                                   const struct todoo_bmp *bmp){
+    uint32_t row, x;
+
+    todoo_image_colors = 0;
+    for(row=0;row<bmp->height;row++){
+        if(todoo_image_bmp_row(dev, bmp, row)){
+            return -1;
+        }
+        for(x=0;x<bmp->width;x++){
+            if(todoo_image_pal_index(todoo_image_row + 2 * x) < todoo_image_colors){
+                continue;
+            }
+            if(todoo_image_colors == 256){
+                return -1;
+            }
+            todoo_image_pal[todoo_image_colors++] =
+                (todoo_image_row[2*x] << 8) | todoo_image_row[2*x+1];
+        }
+    }
+    return 0;
+}
+
+/*
+* Encode the BMP file in hdr->format, setting hdr->len and hdr->crc. The
+* pixels go to the store through wr, with wr NULL nothing is written: the
+* image is only sized.
+*/
+static int todoo_image_encode(struct sst26_dev *dev,
+                              const struct todoo_bmp *bmp,
+                              struct todoo_image_hdr *hdr,
+                              struct todoo_store_wr *wr){
+    uint32_t row, x, fill, bpp, acc, nbits;
+    uint16_t crc;
+
+    crc = CRC16_INITIAL_CRC;
+    hdr->len = 0;
+    fill = 0;
+    acc = 0;
+    nbits = 0;
+
+    bpp = TODOO_IMAGE_PAL_BPP(hdr->format);
+    if(TODOO_IMAGE_IS_PAL(hdr->format)){
+        for(x=0;x<hdr->colors;x++){
+            todoo_image_buf[fill++] = todoo_image_pal[x] >> 8;
+            todoo_image_buf[fill++] = todoo_image_pal[x];
+        }
+    }
+
+    for(row=0;row<bmp->height;row++){
+        if(todoo_image_bmp_row(dev, bmp, row)){
+            return -1;
+        }
+
+        switch(hdr->format){
+        case TODOO_IMAGE_RLE565:
+            fill += todoo_image_rle_row(todoo_image_row, bmp->width,
+                                        todoo_image_buf + fill);
+            break;
+        case TODOO_IMAGE_RGB565_BE:
+            memcpy(todoo_image_buf + fill, todoo_image_row, bmp->width * 2);
+            fill += bmp->width * 2;
+            break;
+        default:
+            /* bpp divides 8, indexes never straddle two bytes */
+            for(x=0;x<bmp->width;x++){
+                acc = (acc << bpp) | todoo_image_pal_index(todoo_image_row + 2 * x);
+                nbits += bpp;
+                if(nbits == 8){
+                    todoo_image_buf[fill++] = acc;
+                    acc = 0;
+                    nbits = 0;
+                }
+            }
+            if(row == bmp->height - 1 && nbits){
+                todoo_image_buf[fill++] = acc << (8 - nbits);
+            }
+            break;
+        }
+
+        /* Room for one more row, RLE literals at worst */
+        if(fill + bmp->width * 2 + 1 > sizeof(todoo_image_buf) ||
+           row == bmp->height - 1){
+            if(wr && todoo_store_write(wr, todoo_image_buf, fill)){
+                return -1;
+            }
+            crc = crc16_ccitt(crc, todoo_image_buf, fill);
+            hdr->len += fill;
+            fill = 0;
+        }
+    }
+
+    hdr->crc = crc;
+    return 0;
+}
+
+/*
+* Whether the rows of the picture are all erased flash.
+*/
+static int todoo_image_bmp_blank(struct sst26_dev *dev,
+                                 const struct todoo_bmp *bmp){
+    uint32_t row, k;
+
+    for(row=0;row<bmp->height;row++){
+        if(todoo_image_bmp_row(dev, bmp, row)){
+            return 0;
+        }
+        for(k=0;k<bmp->width*2;k++){
+            if(todoo_image_row[k] != 0xff){
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+* Convert the picture into a Todoo image registered as asset id, in the
+* smallest of the formats: palette, RLE565 or plain RGB565. The image goes
+* to a new extent of the store, the picture isn't touched.
+*/
+static int todoo_image_convert(struct sst26_dev *dev,
+                               const struct todoo_bmp *bmp, uint16_t id){
+    struct todoo_image_hdr hdr, best;
+    struct todoo_store_wr wr;
+    uint32_t bpp;
+
+    memset(&best, 0, sizeof(best));
+    best.magic = TODOO_IMAGE_MAGIC;
+    best.hdr_len = sizeof(best);
+    best.width = bmp->width;
+    best.height = bmp->height;
+    best.format = TODOO_IMAGE_RGB565_BE;
+    if(todoo_image_encode(dev, bmp, &best, NULL)){
+        return -1;
+    }
+
+    hdr = best;
+    hdr.format = TODOO_IMAGE_RLE565;
+    if(todoo_image_encode(dev, bmp, &hdr, NULL) == 0 && hdr.len < best.len){
+        best = hdr;
+    }
+
+    if(todoo_image_bmp_palette(dev, bmp) == 0){
+        for(bpp=1;(1 << bpp) < todoo_image_colors;bpp*=2);
+        hdr = best;
+        hdr.format = 0x10 | bpp;
+        hdr.colors = todoo_image_colors;
+        if(todoo_image_encode(dev, bmp, &hdr, NULL) == 0 && hdr.len < best.len){
+            best = hdr;
+        }
+    }
+
+    /* The store writes the header and registers the asset once checked */
+    if(todoo_store_begin(&wr, id, &best)){
+        return -1;
+    }
+    hdr = best;
+    if(todoo_image_encode(dev, bmp, &hdr, &wr)){
+        todoo_store_abort(&wr);
+        return -1;
+    }
+    return todoo_store_commit(&wr);
+}
+
+/*
+* Convert the 16-bit BMP file at addr into a Todoo image registered as
+* asset id (see todoo_image_convert()). The file is only retired once the
+* asset points to the image, by clearing its signature: a reset at any
+* point leaves either the file or the image. A Todoo image already at
+* addr, converted in place by an earlier version, is registered as is.
+* Returns 0 once asset id is the picture, -1 otherwise.
+*/
+int todoo_image_from_bmp(struct sst26_dev *dev, uint32_t addr, uint16_t id){
+    static const uint8_t retired[2] = { 0, 0 };
+    struct todoo_image_hdr hdr;
+    struct todoo_bmp bmp;
+    uint8_t head[32];
+
+    if(todoo_image_read_hdr(dev, addr, &hdr) == 0){
+        return todoo_asset_add(id, addr);
+    }
+
+    if(sst26_read((struct hal_flash *) dev, addr, head, sizeof(head))){
+        return -1;
+    }
+
+    /* Bitmap file, 16 bits per pixel */
+    if(head[0] != 'B' || head[1] != 'M' || head[28] != 16 || head[29] != 0){
+        return -1;
+    }
+    bmp.addr   = addr;
+    bmp.index  = bmp_get32(head + 10);
+    bmp.width  = bmp_get32(head + 18);
+    bmp.height = bmp_get32(head + 22);
+    if(bmp.width == 0 || bmp.width > TODOO_IMAGE_MAX_SIZE ||
+       bmp.height == 0 || bmp.height > TODOO_IMAGE_MAX_SIZE){
+        return -1;
+    }
+
+    /* BMP rows are padded to 4 bytes */
+    bmp.stride = (bmp.width * 2 + 3) & ~3;
+
+    if(todoo_image_convert(dev, &bmp, id)){
+        return -1;
+    }
+
+    /* Only 1 -> 0 bit changes, no erase */
+    sst26_write((struct hal_flash *) dev, addr, retired, sizeof(retired));
+
+    return 0;
+}
+
+static int todoo_image_raw(struct todoo_bmp *bmp, uint32_t addr,
+                           uint32_t width, uint32_t height){
+
+    if(width == 0 || width > TODOO_IMAGE_MAX_SIZE ||
+       height == 0 || height > TODOO_IMAGE_MAX_SIZE){
+        return -1;
+    }
+
+    bmp->addr   = addr;
+    bmp->index  = 0;
+    bmp->width  = width;
+    bmp->height = height;
+    bmp->stride = width * 2;
+    return 0;
+}
+
+/*
+* Whether there is no picture of width x height bare pixels at addr, the
+* area being erased.
+*/
+int todoo_image_raw_blank(struct sst26_dev *dev, uint32_t addr,
+                          uint32_t width, uint32_t height){
+    struct todoo_bmp bmp;
+
+    if(todoo_image_raw(&bmp, addr, width, height)){
+        return 1;
+    }
+    return todoo_image_bmp_blank(dev, &bmp);
+}
+
+/*
+* Convert the bare pixels of a width x height picture at addr, in the
+* order of a BMP file without its header, into a Todoo image registered
+* as asset id (see todoo_image_convert()).
+*/
+int todoo_image_from_raw(struct sst26_dev *dev, uint32_t addr,
+                         uint32_t width, uint32_t height, uint16_t id){
+    struct todoo_bmp bmp;
+
+    if(todoo_image_raw(&bmp, addr, width, height)){
+        return -1;
+    }
+    return todoo_image_convert(dev, &bmp, id);
+}
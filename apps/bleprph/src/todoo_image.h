@@ -0,0 +1,66 @@
+/*
+ * CHIC - China Hardware Innovation Camp - Todoo
+ * https://chi.camp/projects/todoo/
+ *
+ * Picture format of the external memory.
+ *
+ * A Todoo image is a 16 bytes header followed by the pixels in the exact
+ * byte order the LCD takes them: RGB565, high byte first, rows from the
+ * bottom of the picture to the top as written by a window with memory
+ * access control 0x48. Drawing it is a straight copy from flash to LCD.
+ *
+ * RLE565 pixels are the same stream in runs, each starting with a control
+ * byte c: c < 128 is followed by c + 1 literal pixels, c >= 128 by one
+ * pixel to repeat c - 126 times. Runs never cross a row.
+ *
+ * Palette pixels start with the colors entries of the palette, RGB565 high
+ * byte first, followed by the indexes of 1, 2, 4 or 8 bits packed from the
+ * most significant bit, rows not padded.
+ *
+ * Pictures are provisioned as 16-bit BMP files, or the activity ones as
+ * bare pixels, and converted once into the image store, see
+ * todoo_image_from_bmp() and todoo_image_from_raw().
+*/
+
+#ifndef TODOO_IMAGE_H_INCLUDED
+#define TODOO_IMAGE_H_INCLUDED
+
+#include <stdint.h>
+#include <SST26/SST26.h>
+
+#define TODOO_IMAGE_MAGIC       0x4454  /* "TD" */
+
+/* Pixel formats */
+#define TODOO_IMAGE_RGB565_BE   1
+#define TODOO_IMAGE_RLE565      2
+#define TODOO_IMAGE_PAL1        0x11
+#define TODOO_IMAGE_PAL2        0x12
+#define TODOO_IMAGE_PAL4        0x14
+#define TODOO_IMAGE_PAL8        0x18
+
+#define TODOO_IMAGE_IS_PAL(f)   (((f) & 0xf0) == 0x10)
+#define TODOO_IMAGE_PAL_BPP(f)  ((f) & 0x0f)
+
+struct todoo_image_hdr {
+    uint16_t magic;
+    uint8_t  format;
+    uint8_t  hdr_len;       /* Offset of the pixels */
+    uint16_t width;
+    uint16_t height;
+    uint32_t len;           /* Bytes of pixels, as stored */
+    uint16_t crc;           /* CRC16-CCITT of the stored pixels */
+    uint16_t colors;        /* Entries of the palette */
+};
+
+int todoo_image_read_hdr(struct sst26_dev *dev, uint32_t addr,
+                         struct todoo_image_hdr *hdr);
+int todoo_image_check(struct sst26_dev *dev, uint32_t addr,
+                      const struct todoo_image_hdr *hdr);
+uint32_t todoo_image_rle_row(const uint8_t *px, uint32_t width, uint8_t *out);
+int todoo_image_from_bmp(struct sst26_dev *dev, uint32_t addr, uint16_t id);
+int todoo_image_raw_blank(struct sst26_dev *dev, uint32_t addr,
+                          uint32_t width, uint32_t height);
+int todoo_image_from_raw(struct sst26_dev *dev, uint32_t addr,
+                         uint32_t width, uint32_t height, uint16_t id);
+
+#endif
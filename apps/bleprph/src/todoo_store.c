@@ -0,0 +1,600 @@
+/*
+ * CHIC - China Hardware Innovation Camp - Todoo
+ * https://chi.camp/projects/todoo/
+ *
+ * Log-structured store of the Todoo images (see todoo_store.h).
+ *
+ * Like the asset directory, the store is only used by the flash task.
+*/
+
+#include <string.h>
+
+#include "syscfg/syscfg.h"
+#include "os/os.h"
+#include "crc/crc16.h"
+
+#include "todoo_store.h"
+#include "todoo_asset.h"
+
+#define TODOO_STORE_SECTOR      (0x1000)
+#define TODOO_STORE_END         (0x400000)
+#define TODOO_STORE_SECTORS     ((TODOO_STORE_END - TODOO_STORE_START) / TODOO_STORE_SECTOR)
+
+static struct sst26_dev *todoo_store_dev;
+
+/* One bit per sector each */
+static uint8_t todoo_store_clean[TODOO_STORE_SECTORS / 8];     /* Known erased */
+static uint8_t todoo_store_foreign[TODOO_STORE_SECTORS / 8];   /* Data the store didn't write */
+static uint8_t todoo_store_owned[TODOO_STORE_SECTORS / 8];     /* In an extent of the store */
+static uint8_t todoo_store_first[TODOO_STORE_SECTORS / 8];     /* First sector of an extent */
+static uint8_t todoo_store_stale[TODOO_STORE_SECTORS / 8];     /* Released, to erase unless blank */
+
+/* Next sector to allocate from, and to look at for reclaim */
+static uint32_t todoo_store_head;
+static uint32_t todoo_store_gc_next;
+
+/* No dead extent left to reclaim, no sector left to look at */
+static uint8_t todoo_store_gc_done;
+
+/* Extent of the image being written, not an asset yet */
+static uint32_t todoo_store_wr_start;
+static uint32_t todoo_store_wr_count;
+
+/* Blank check buffer */
+static uint8_t todoo_store_buf[256];
+
+static int todoo_store_test(const uint8_t *map, uint32_t sector){
+    return map[sector / 8] & (1 << (sector % 8));
+}
+
+static void todoo_store_set(uint8_t *map, uint32_t sector, int set){
+    if(set){
+        map[sector / 8] |= 1 << (sector % 8);
+    }else{
+        map[sector / 8] &= ~(1 << (sector % 8));
+    }
+}
+
+static uint32_t todoo_store_sector_addr(uint32_t sector){
+    return TODOO_STORE_START + sector * TODOO_STORE_SECTOR;
+}
+
+/*
+* First sector of the extent holding an owned sector, and its number of
+* sectors.
+*/
+static uint32_t todoo_store_extent_first(uint32_t sector){
+    while(!todoo_store_test(todoo_store_first, sector)){
+        sector--;
+    }
+    return sector;
+}
+
+static uint32_t todoo_store_extent_count(uint32_t first){
+    uint32_t sector;
+
+    for(sector=first+1;sector<TODOO_STORE_SECTORS;sector++){
+        if(!todoo_store_test(todoo_store_owned, sector) ||
+           todoo_store_test(todoo_store_first, sector)){
+            break;
+        }
+    }
+    return sector - first;
+}
+
+/*
+* Whether an asset, an image another task holds or the image being written
+* lies in the extent, see todoo_asset_in_use(). Once dead, no task can take
+* it anymore.
+*/
+static int todoo_store_is_live(uint32_t first){
+    uint32_t start;
+
+    if(todoo_store_wr_count && first == todoo_store_wr_start){
+        return 1;
+    }
+
+    start = todoo_store_sector_addr(first);
+    return todoo_asset_in_use(start, start + todoo_store_extent_count(first) *
+                                     TODOO_STORE_SECTOR);
+}
+
+/*
+* Look at a sector the store knows nothing about: clean if it's blank,
+* foreign otherwise, never to be erased.
+*/
+static int todoo_store_probe(uint32_t sector){
+    uint32_t addr, i, k;
+
+    addr = todoo_store_sector_addr(sector);
+    for(i=0;i<TODOO_STORE_SECTOR;i+=sizeof(todoo_store_buf)){
+        if(sst26_read((struct hal_flash *) todoo_store_dev, addr + i,
+                      todoo_store_buf, sizeof(todoo_store_buf))){
+            return -1;
+        }
+        for(k=0;k<sizeof(todoo_store_buf);k++){
+            if(todoo_store_buf[k] != 0xff){
+                todoo_store_set(todoo_store_foreign, sector, 1);
+                return 0;
+            }
+        }
+    }
+
+    todoo_store_set(todoo_store_clean, sector, 1);
+    return 0;
+}
+
+/*
+* Erase the last sector of a dead extent that isn't clean yet. The one
+* holding the extent head goes last, so that what's left of the extent
+* is still known as such after a reset. Returns 1 once the extent is
+* gone, its sectors clean.
+*/
+static int todoo_store_reclaim(uint32_t first){
+    uint32_t count, sector;
+
+    count = todoo_store_extent_count(first);
+    for(sector=first+count;sector-->first;){
+        if(todoo_store_test(todoo_store_clean, sector)){
+            continue;
+        }
+        if(sst26_sector_erase((struct hal_flash *) todoo_store_dev,
+                              todoo_store_sector_addr(sector))){
+            return -1;
+        }
+        todoo_store_set(todoo_store_clean, sector, 1);
+        if(sector != first){
+            return 0;
+        }
+    }
+
+    for(sector=first;sector<first+count;sector++){
+        todoo_store_set(todoo_store_owned, sector, 0);
+        todoo_store_set(todoo_store_first, sector, 0);
+    }
+    return 1;
+}
+
+/*
+* Whether the sector can be allocated: clean, blank or in a dead extent.
+*/
+static int todoo_store_is_free(uint32_t sector){
+
+    if(todoo_store_test(todoo_store_owned, sector)){
+        return !todoo_store_is_live(todoo_store_extent_first(sector));
+    }
+    if(todoo_store_test(todoo_store_stale, sector)){
+        return 0;
+    }
+    if(!todoo_store_test(todoo_store_clean, sector) &&
+       !todoo_store_test(todoo_store_foreign, sector) &&
+       todoo_store_probe(sector)){
+        return 0;
+    }
+    return todoo_store_test(todoo_store_clean, sector);
+}
+
+/*
+* Find count free sectors in a row from the head, make them clean and
+* write the head of the extent in the first. Returns the first one, or -1
+* if the store is full.
+*/
+static int todoo_store_alloc(uint32_t count){
+    struct todoo_store_extent ext;
+    uint32_t start, run, tried, sector;
+    int rc;
+
+    start = todoo_store_head;
+    run = 0;
+    for(tried=0;tried<TODOO_STORE_SECTORS + count;tried++){
+        sector = (todoo_store_head + tried) % TODOO_STORE_SECTORS;
+
+        /* Extents don't wrap around the end of the chip */
+        if(sector == 0){
+            start = 0;
+            run = 0;
+        }
+
+        if(!todoo_store_is_free(sector)){
+            start = sector + 1;
+            run = 0;
+            continue;
+        }
+        if(++run == count){
+            break;
+        }
+    }
+    if(run < count){
+        return -1;
+    }
+
+    /* Dead extents the run goes through are reclaimed whole */
+    for(sector=start;sector<start+count;sector++){
+        while(todoo_store_test(todoo_store_owned, sector)){
+            rc = todoo_store_reclaim(todoo_store_extent_first(sector));
+            if(rc < 0){
+                return -1;
+            }
+        }
+    }
+
+    memset(&ext, 0xff, sizeof(ext));
+    ext.magic = TODOO_STORE_MAGIC;
+    ext.count = count;
+    ext.count_inv = ~count;
+    if(sst26_write((struct hal_flash *) todoo_store_dev,
+                   todoo_store_sector_addr(start), &ext, sizeof(ext))){
+        return -1;
+    }
+
+    for(sector=start;sector<start+count;sector++){
+        todoo_store_set(todoo_store_clean, sector, 0);
+        todoo_store_set(todoo_store_owned, sector, 1);
+    }
+    todoo_store_set(todoo_store_first, start, 1);
+
+    todoo_store_head = (start + count) % TODOO_STORE_SECTORS;
+    return start;
+}
+
+/*
+* Stored image that may be identical to hdr: one with the same CRC, else
+* the current image of asset id if it has the same size. Its pixels are
+* compared with the new ones as they come. NULL if there is none.
+*/
+static const struct todoo_asset *todoo_store_find_dup(uint16_t id,
+                                                      const struct todoo_image_hdr *hdr){
+    const struct todoo_asset *asset, *same;
+    struct todoo_image_hdr cur;
+    uint16_t i;
+
+    same = NULL;
+    for(i=0;i<MYNEWT_VAL(TODOO_ASSET_MAX);i++){
+        asset = todoo_asset_find(i);
+        if(asset == NULL || asset->format != hdr->format ||
+           asset->len != hdr->hdr_len + hdr->len ||
+           (asset->crc != hdr->crc && i != id)){
+            continue;
+        }
+        if(todoo_image_read_hdr(todoo_store_dev, asset->addr, &cur) ||
+           cur.width != hdr->width || cur.height != hdr->height ||
+           cur.colors != hdr->colors){
+            continue;
+        }
+        if(asset->crc == hdr->crc){
+            return asset;
+        }
+        same = asset;
+    }
+    return same;
+}
+
+/*
+* Whether the len bytes of buf are the ones stored at addr.
+*/
+static int todoo_store_same(uint32_t addr, const uint8_t *buf, uint32_t len){
+    uint32_t chunk;
+
+    while(len){
+        chunk = len < sizeof(todoo_store_buf) ? len : sizeof(todoo_store_buf);
+        if(sst26_read((struct hal_flash *) todoo_store_dev, addr,
+                      todoo_store_buf, chunk) ||
+           memcmp(todoo_store_buf, buf, chunk)){
+            return 0;
+        }
+        addr += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+    return 1;
+}
+
+/*
+* Allocate the extent of the image being written.
+*/
+static int todoo_store_open(struct todoo_store_wr *wr){
+    uint32_t count;
+    int sector;
+
+    count = (sizeof(struct todoo_store_extent) + wr->hdr.hdr_len + wr->len +
+             TODOO_STORE_SECTOR - 1) / TODOO_STORE_SECTOR;
+    sector = todoo_store_alloc(count);
+    if(sector < 0){
+        return -1;
+    }
+    todoo_store_wr_start = sector;
+    todoo_store_wr_count = count;
+    wr->dup = 0;
+    wr->addr = todoo_store_sector_addr(sector) + sizeof(struct todoo_store_extent);
+    return 0;
+}
+
+/*
+* The image turned out to differ from the stored one it was compared with:
+* give it its own extent, with the pixels so far copied from the other.
+*/
+static int todoo_store_undup(struct todoo_store_wr *wr){
+    uint32_t src, i, chunk;
+
+    src = wr->addr + wr->hdr.hdr_len;
+    if(todoo_store_open(wr)){
+        return -1;
+    }
+
+    for(i=0;i<wr->off;i+=chunk){
+        chunk = wr->off - i;
+        if(chunk > sizeof(todoo_store_buf)){
+            chunk = sizeof(todoo_store_buf);
+        }
+        if(sst26_read((struct hal_flash *) todoo_store_dev, src + i,
+                      todoo_store_buf, chunk) ||
+           sst26_write((struct hal_flash *) todoo_store_dev,
+                       wr->addr + wr->hdr.hdr_len + i, todoo_store_buf, chunk)){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+* Set the store up, the asset directory must be loaded. The extents are
+* found again from their heads, other sectors are only known to be clean
+* or foreign once looked at, by the allocation or the GC.
+*/
+int todoo_store_init(struct sst26_dev *dev){
+    struct todoo_store_extent ext;
+    uint32_t sector, k;
+
+    todoo_store_dev = dev;
+    memset(todoo_store_clean, 0, sizeof(todoo_store_clean));
+    memset(todoo_store_foreign, 0, sizeof(todoo_store_foreign));
+    memset(todoo_store_owned, 0, sizeof(todoo_store_owned));
+    memset(todoo_store_first, 0, sizeof(todoo_store_first));
+    memset(todoo_store_stale, 0, sizeof(todoo_store_stale));
+    todoo_store_head = 0;
+    todoo_store_gc_next = 0;
+    todoo_store_gc_done = 0;
+    todoo_store_wr_count = 0;
+
+    sector = 0;
+    while(sector < TODOO_STORE_SECTORS){
+        if(sst26_read((struct hal_flash *) dev, todoo_store_sector_addr(sector),
+                      &ext, sizeof(ext))){
+            return -1;
+        }
+        if(ext.magic != TODOO_STORE_MAGIC || ext.count == 0 ||
+           ext.count_inv != (uint16_t) ~ext.count ||
+           sector + ext.count > TODOO_STORE_SECTORS){
+            sector++;
+            continue;
+        }
+
+        todoo_store_set(todoo_store_first, sector, 1);
+        for(k=0;k<ext.count;k++){
+            todoo_store_set(todoo_store_owned, sector + k, 1);
+        }
+        sector += ext.count;
+
+        /* Allocate after the last extent written, roughly */
+        todoo_store_head = sector % TODOO_STORE_SECTORS;
+    }
+    return 0;
+}
+
+/*
+* Whether the store has an extent in [addr, addr + len).
+*/
+int todoo_store_owns(uint32_t addr, uint32_t len){
+    uint32_t sector;
+
+    for(sector=0;sector<TODOO_STORE_SECTORS;sector++){
+        if(todoo_store_sector_addr(sector) < addr + len &&
+           todoo_store_sector_addr(sector) + TODOO_STORE_SECTOR > addr &&
+           todoo_store_test(todoo_store_owned, sector)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+* Keep the store off [addr, addr + len) for now, the sectors that it
+* doesn't own are taken as foreign even if they look erased.
+*/
+void todoo_store_reserve(uint32_t addr, uint32_t len){
+    uint32_t sector;
+
+    for(sector=0;sector<TODOO_STORE_SECTORS;sector++){
+        if(todoo_store_sector_addr(sector) < addr + len &&
+           todoo_store_sector_addr(sector) + TODOO_STORE_SECTOR > addr &&
+           !todoo_store_test(todoo_store_owned, sector)){
+            todoo_store_set(todoo_store_clean, sector, 0);
+            todoo_store_set(todoo_store_foreign, sector, 1);
+        }
+    }
+}
+
+/*
+* Hand the sectors wholly in [addr, addr + len) back to the store once
+* their data was converted into it: the GC erases those that aren't blank,
+* then they are allocated like the others. The sectors shared with data
+* still needed stay as they are.
+*/
+void todoo_store_release(uint32_t addr, uint32_t len){
+    uint32_t sector;
+
+    for(sector=0;sector<TODOO_STORE_SECTORS;sector++){
+        if(todoo_store_sector_addr(sector) >= addr &&
+           todoo_store_sector_addr(sector) + TODOO_STORE_SECTOR <= addr + len &&
+           !todoo_store_test(todoo_store_owned, sector) &&
+           !todoo_store_test(todoo_store_clean, sector)){
+            todoo_store_set(todoo_store_stale, sector, 1);
+            todoo_store_gc_done = 0;
+        }
+    }
+}
+
+/*
+* Start writing the image of header hdr as asset id, its pixels follow
+* with todoo_store_write(). The CRC of hdr is only a hint to find an
+* identical image, the one of the pixels written is stored. -1 if the
+* store is full.
+*/
+int todoo_store_begin(struct todoo_store_wr *wr, uint16_t id,
+                      const struct todoo_image_hdr *hdr){
+    const struct todoo_asset *dup;
+
+    if(todoo_store_wr_count || hdr->magic != TODOO_IMAGE_MAGIC ||
+       hdr->hdr_len != sizeof(*hdr)){
+        return -1;
+    }
+
+    memset(wr, 0, sizeof(*wr));
+    wr->id = id;
+    wr->len = hdr->len;
+    wr->crc = CRC16_INITIAL_CRC;
+    wr->hdr = *hdr;
+
+    /* Nothing is allocated as long as the pixels are the same */
+    dup = todoo_store_find_dup(id, hdr);
+    if(dup){
+        wr->dup = 1;
+        wr->addr = dup->addr;
+        return 0;
+    }
+
+    return todoo_store_open(wr);
+}
+
+/*
+* Append pixels to the image.
+*/
+int todoo_store_write(struct todoo_store_wr *wr, const void *buf, uint32_t len){
+
+    if(wr->off + len > wr->len){
+        return -1;
+    }
+    if(wr->dup &&
+       !todoo_store_same(wr->addr + wr->hdr.hdr_len + wr->off, buf, len) &&
+       todoo_store_undup(wr)){
+        return -1;
+    }
+    if(!wr->dup &&
+       sst26_write((struct hal_flash *) todoo_store_dev,
+                   wr->addr + wr->hdr.hdr_len + wr->off, buf, len)){
+        return -1;
+    }
+    wr->crc = crc16_ccitt(wr->crc, buf, len);
+    wr->off += len;
+    return 0;
+}
+
+/*
+* Write the header once all the pixels are in, check them and point the
+* asset at the image. Nothing is written if it's already the case.
+*/
+int todoo_store_commit(struct todoo_store_wr *wr){
+    const struct todoo_asset *asset;
+    int rc;
+
+    if(wr->off != wr->len){
+        todoo_store_abort(wr);
+        return -1;
+    }
+
+    if(!wr->dup){
+        wr->hdr.crc = wr->crc;
+        rc = sst26_write((struct hal_flash *) todoo_store_dev, wr->addr,
+                         &wr->hdr, sizeof(wr->hdr));
+        if(rc == 0){
+            rc = todoo_image_check(todoo_store_dev, wr->addr, &wr->hdr);
+        }
+        if(rc){
+            todoo_store_abort(wr);
+            return -1;
+        }
+    }
+
+    asset = todoo_asset_find(wr->id);
+    rc = 0;
+    if(asset == NULL || asset->addr != wr->addr){
+        rc = todoo_asset_add(wr->id, wr->addr);
+    }
+
+    /* The extent is an asset now, or garbage, the previous one is dead */
+    todoo_store_wr_count = 0;
+    todoo_store_gc_done = 0;
+    return rc;
+}
+
+/*
+* Give up the image, its extent is left to the GC.
+*/
+void todoo_store_abort(struct todoo_store_wr *wr){
+
+    if(!wr->dup){
+        todoo_store_wr_count = 0;
+        todoo_store_gc_done = 0;
+    }
+}
+
+/*
+* Erase a sector of the next dead extent or a released one, or else look
+* at the next sector the store knows nothing about. Meant to be called
+* regularly by the flash task, returns 1 once there is nothing left to do.
+*/
+int todoo_store_gc(void){
+    uint32_t i, sector;
+    int live, held;
+
+    if(todoo_store_gc_done){
+        return 1;
+    }
+
+    held = 0;
+    for(i=0;i<TODOO_STORE_SECTORS;i++){
+        sector = todoo_store_gc_next;
+
+        if(todoo_store_test(todoo_store_owned, sector)){
+            sector = todoo_store_extent_first(sector);
+            live = todoo_store_is_live(sector);
+            if(!live){
+                /* Same extent again on the next call, until it's gone */
+                todoo_store_reclaim(sector);
+                return 0;
+            }
+            held |= live == TODOO_ASSET_HELD;
+            todoo_store_gc_next = (sector + todoo_store_extent_count(sector)) %
+                                  TODOO_STORE_SECTORS;
+            continue;
+        }
+
+        todoo_store_gc_next = (sector + 1) % TODOO_STORE_SECTORS;
+        if(todoo_store_test(todoo_store_stale, sector)){
+            if(!todoo_store_test(todoo_store_foreign, sector) &&
+               (todoo_store_probe(sector) ||
+                todoo_store_test(todoo_store_clean, sector))){
+                /* Blank already, or to look at again on the next round */
+                todoo_store_set(todoo_store_stale, sector,
+                                !todoo_store_test(todoo_store_clean, sector));
+                return 0;
+            }
+            if(sst26_sector_erase((struct hal_flash *) todoo_store_dev,
+                                  todoo_store_sector_addr(sector)) == 0){
+                todoo_store_set(todoo_store_stale, sector, 0);
+                todoo_store_set(todoo_store_foreign, sector, 0);
+                todoo_store_set(todoo_store_clean, sector, 1);
+            }
+            return 0;
+        }
+        if(!todoo_store_test(todoo_store_clean, sector) &&
+           !todoo_store_test(todoo_store_foreign, sector)){
+            todoo_store_probe(sector);
+            return 0;
+        }
+    }
+
+    /* An image still shown is looked at again until it's given back */
+    todoo_store_gc_done = !held;
+    return 1;
+}
@@ -0,0 +1,65 @@
+/*
+ * CHIC - China Hardware Innovation Camp - Todoo
+ * https://chi.camp/projects/todoo/
+ *
+ * Log-structured store of the Todoo images of the external memory.
+ *
+ * From TODOO_STORE_START to the end of the chip, every image gets its own
+ * extent of whole sectors, so writing one never erases another. A new
+ * version of an asset goes to the next free extent after the last one
+ * written, and the asset directory is then pointed at it. Extents no
+ * asset points to are reclaimed by todoo_store_gc() in the background.
+ *
+ * Each extent starts with a head giving its number of sectors, written
+ * before the image, so the extents are known again after a reset. Only
+ * they are ever erased: data the store didn't write, like pictures
+ * provisioned in the area, is left alone until it's handed over with
+ * todoo_store_release().
+ *
+ * An image identical to a stored one isn't written again, the asset points
+ * to the stored extent instead. The candidate, found by size and CRC, is
+ * read back and compared with the pixels as they come: the image only
+ * gets an extent of its own once they differ.
+*/
+
+#ifndef TODOO_STORE_H_INCLUDED
+#define TODOO_STORE_H_INCLUDED
+
+#include <stdint.h>
+#include <SST26/SST26.h>
+#include "todoo_image.h"
+
+#define TODOO_STORE_START       (0x040000)
+#define TODOO_STORE_MAGIC       0x53544f44  /* "DOTS" */
+
+/* Head of an extent, the image follows */
+struct todoo_store_extent {
+    uint32_t magic;
+    uint16_t count;         /* Sectors */
+    uint16_t count_inv;     /* ~count */
+    uint32_t reserved[2];
+};
+
+/* Image being written, see todoo_store_begin() */
+struct todoo_store_wr {
+    uint16_t id;
+    uint8_t  dup;           /* Identical to the image at addr so far */
+    uint16_t crc;           /* Of the pixels written */
+    uint32_t addr;          /* Of the image */
+    uint32_t len;           /* Of the pixels */
+    uint32_t off;           /* Pixels written */
+    struct todoo_image_hdr hdr;
+};
+
+int todoo_store_init(struct sst26_dev *dev);
+int todoo_store_begin(struct todoo_store_wr *wr, uint16_t id,
+                      const struct todoo_image_hdr *hdr);
+int todoo_store_write(struct todoo_store_wr *wr, const void *buf, uint32_t len);
+int todoo_store_commit(struct todoo_store_wr *wr);
+void todoo_store_abort(struct todoo_store_wr *wr);
+int todoo_store_gc(void);
+int todoo_store_owns(uint32_t addr, uint32_t len);
+void todoo_store_reserve(uint32_t addr, uint32_t len);
+void todoo_store_release(uint32_t addr, uint32_t len);
+
+#endif
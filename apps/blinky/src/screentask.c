@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "sysinit/sysinit.h"
+#include "syscfg/syscfg.h"
 #include "os/os.h"
 #include "bsp/bsp.h"
 #include "hal/hal_gpio.h"
@@ -16,6 +17,9 @@
 /* SPI */
 #include <hal/hal_spi.h>
 #include <SST26/SST26.h>
+#if MYNEWT_VAL(SST26_BENCH)
+#include "console/console.h"
+#endif
 #include "mcu/nrf52_hal.h"
 #include "screentask.h"
 #include "lcd/lcd.h"
@@ -284,6 +288,34 @@ screen_task_handler(void *arg)
         // XXX: error handling 
     }
 
+#if MYNEWT_VAL(SST26_BENCH)
+    /*
+    * Throughput of the external memory on its last sector, rewritten with
+    * its own content: through the driver, then one SPI transfer per byte
+    * as it used to be. SPI transfers per KB in hundredths.
+    */
+    struct sst26_bench bench;
+    uint32_t bench_addr, bench_size;
+    sst26_sector_info((struct hal_flash *) my_sst26_dev, my_sst26_dev->hal.hf_sector_cnt - 1,
+                      &bench_addr, &bench_size);
+    if (sst26_bench((struct hal_flash *) my_sst26_dev, bench_addr, &bench) == 0) {
+        console_printf("sst26 bench read: %lu B/s %lu.%02lu xfers/KB, bytewise %lu B/s %lu.%02lu xfers/KB\n",
+                       (unsigned long) bench.read_bps,
+                       (unsigned long) bench.read_xfers / 100,
+                       (unsigned long) bench.read_xfers % 100,
+                       (unsigned long) bench.read_bytewise_bps,
+                       (unsigned long) bench.read_bytewise_xfers / 100,
+                       (unsigned long) bench.read_bytewise_xfers % 100);
+        console_printf("sst26 bench program: %lu B/s %lu.%02lu xfers/KB, bytewise %lu B/s %lu.%02lu xfers/KB\n",
+                       (unsigned long) bench.program_bps,
+                       (unsigned long) bench.program_xfers / 100,
+                       (unsigned long) bench.program_xfers % 100,
+                       (unsigned long) bench.program_bytewise_bps,
+                       (unsigned long) bench.program_bytewise_xfers / 100,
+                       (unsigned long) bench.program_bytewise_xfers % 100);
+    }
+#endif
+
 
 
     
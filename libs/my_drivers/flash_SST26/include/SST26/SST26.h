@@ -20,6 +20,7 @@
 #ifndef __SST26_H__
 #define __SST26_H__
 
+#include <os/os.h>
 #include <hal/hal_flash_int.h>
 #include <hal/hal_spi.h>
 
@@ -27,6 +28,14 @@
 extern "C" {
 #endif
 
+/**
+ * Completion callback of sst26_bus_txrx_noblock() and sst26_read_noblock(),
+ * called from the SPI interrupt with the number of bytes transferred.
+ */
+typedef void (*sst26_done_cb)(void *arg, int len);
+
+struct sst26_stream;
+
 struct sst26_dev {
     struct hal_flash hal;
     struct hal_spi_settings *settings;
@@ -36,15 +45,42 @@ struct sst26_dev {
     uint32_t baudrate;
     uint16_t page_size;             /** Page size to be used, valid: 512 and 528 */
     uint8_t disable_auto_erase;     /** Reads and writes auto-erase by default */
+    uint8_t txrx_cb_set;            /** The SPI callback is sst26_bus_txrx_done() */
+    sst26_done_cb done_cb;          /** Of the bus holder's pending transfer */
+    void *done_arg;
+    sst26_done_cb read_cb;          /** Of the sst26_read_noblock() running */
+    void *read_arg;
+    uint8_t busy_op;                /** Last program/erase opcode started */
+    uint8_t suspended;              /** busy_op is an erase on suspend */
+    uint32_t busy_start;            /** os_cputime when it was started */
+    uint32_t busy_addr;             /** Area busy_op works on */
+    uint32_t busy_size;
+    uint32_t suspend_start;         /** os_cputime of the last suspend */
+    uint32_t resume_time;           /** os_cputime of the last resume */
+    struct os_mutex bus_lock;       /** Shared SPI bus, see sst26_bus_acquire() */
+    int bus_depth;                  /** Nesting of bus_lock by its owner */
+    struct sst26_stream *stream;    /** Stream holding the chip selected */
+};
+
+/**
+ * Read cursor keeping a single READ transaction open between calls, see
+ * sst26_stream_open().
+ */
+struct sst26_stream {
+    struct sst26_dev *dev;
+    uint32_t addr;                  /** Address of the next byte */
 };
 
 struct sst26_dev * sst26_default_config(void);
 int sst26_read(const struct hal_flash *hal_flash_dev, uint32_t addr, void *buf,
                 uint32_t len);
+int sst26_read_noblock(struct sst26_dev *dev, uint32_t addr, void *buf,
+                uint32_t len, sst26_done_cb done_cb, void *arg);
 int sst26_write(const struct hal_flash *hal_flash_dev, uint32_t addr, const void *buf,
                  uint32_t len);
 
-// int sst26_erase_sector(const struct hal_flash *dev, uint32_t sector_address);
+int sst26_erase_sector(const struct hal_flash *hal_flash_dev,
+                    uint32_t sector_address);
 
 int sst26_sector_erase(const struct hal_flash *hal_flash_dev,
                     uint32_t sector_address);
@@ -54,10 +90,46 @@ int sst26_block_erase(const struct hal_flash *hal_flash_dev,
 
 int sst26_chip_erase(const struct hal_flash *hal_flash_dev);
 
-//int sst26_sector_info(const struct hal_flash *dev, int idx, uint32_t *address, uint32_t *sz);
+int sst26_erase_range(const struct hal_flash *hal_flash_dev, uint32_t addr,
+                    uint32_t len);
+
+int sst26_sector_info(const struct hal_flash *hal_flash_dev, int idx,
+                    uint32_t *address, uint32_t *sz);
 
 int sst26_init(const struct hal_flash *dev);
 
+void sst26_bus_acquire(struct sst26_dev *dev);
+void sst26_bus_release(struct sst26_dev *dev);
+int sst26_bus_txrx_noblock(struct sst26_dev *dev, void *txbuf, void *rxbuf,
+                           int len, sst26_done_cb done_cb, void *arg);
+
+int sst26_stream_open(struct sst26_dev *dev, struct sst26_stream *stream,
+                uint32_t addr);
+int sst26_stream_read(struct sst26_stream *stream, void *buf, uint32_t len);
+void sst26_stream_close(struct sst26_stream *stream);
+
+/**
+ * Throughput of the array measured by sst26_bench(), in bytes/s and in
+ * SPI transfers per KB (hundredths, from the spi_xfers stat). The
+ * *_bytewise figures go through one SPI transfer per byte, the way the
+ * driver used to, for comparison. The program figures include the end of
+ * the last page program and the status polls.
+ */
+struct sst26_bench {
+    uint32_t read_bps;
+    uint32_t read_bytewise_bps;
+    uint32_t program_bps;
+    uint32_t program_bytewise_bps;
+    uint32_t read_xfers;
+    uint32_t read_bytewise_xfers;
+    uint32_t program_xfers;
+    uint32_t program_bytewise_xfers;
+};
+
+/* With SST26_BENCH only */
+int sst26_bench(const struct hal_flash *hal_flash_dev, uint32_t sector_addr,
+                struct sst26_bench *res);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,48 @@
+/*
+ * RAM-backed SST26 model for the native BSP
+ *
+ * CHIC - China Hardware Innovation Camp - Todoo
+ * https://chi.camp/projects/todoo/
+*/
+
+#ifndef __SST26_SIM_H__
+#define __SST26_SIM_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Counters kept by the model, reset by the first sst26_sim_init() and by
+ * sst26_sim_reset(). The *_errors entries count commands that a real chip
+ * would have ignored or mis-executed; a correct driver keeps them at zero.
+ */
+struct sst26_sim_stats {
+    uint32_t transactions;          /** CS low/high cycles */
+    uint32_t bytes;                 /** Bytes clocked on the bus */
+    uint32_t reads;
+    uint32_t page_programs;
+    uint32_t sector_erases;
+    uint32_t block_erases;
+    uint32_t chip_erases;
+    uint32_t suspends;
+    uint32_t busy_us;               /** Total time the array was busy */
+    uint32_t program_errors;        /** Tried to program a 0 bit back to 1 */
+    uint32_t wel_errors;            /** Write command without WREN */
+    uint32_t protect_errors;        /** Write while blocks are protected */
+    uint32_t busy_errors;           /** Command other than status while busy */
+    uint32_t suspend_errors;        /** Suspended block read, or write on suspend */
+};
+
+void sst26_sim_init(void);
+void sst26_sim_reset(void);
+void sst26_sim_load(uint32_t addr, const void *buf, uint32_t len);
+const struct sst26_sim_stats *sst26_sim_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SST26_SIM_H__ */
@@ -12,53 +12,45 @@
  * 2018, January 11
 */
 
+#include "syscfg/syscfg.h"
 #include <os/os.h>
+#include <stats/stats.h>
 
 #include <hal/hal_spi.h>
 #include <hal/hal_gpio.h>
 #include <hal/hal_flash.h>
 #include <hal/hal_flash_int.h>
 #include <SST26/SST26.h>
+#if MYNEWT_VAL(SST26_SIM)
+#include <SST26/SST26_sim.h>
+#endif
+#include "sst26_priv.h"
 
 #include <string.h>
 
-#define ULBPR           0x98
-#define SE              0x20    /**< Erase 4 KBytes of Memory Array */
-#define BE              0xD8    /**< Erase 64, 32 or 8 KBytes of Memory Array */
-#define CE              0xC7    /**< Erase Full Array */
-#define PP              0x02    /**< Page Program */
-#define READ            0x03    /**< Read Memory */
-#define WREN            0x06    /**< Write Enable */
-
-#define STATUS_REGISTER 0x05
-
-#define MAX_PAGE_SIZE   256
-
-#define STATUS_BUSY     (1 << 7)
-
-
 
 static inline void sst26_write_enable(struct sst26_dev *dev);
-static inline void sst26_write_address(struct sst26_dev *dev, uint32_t address);
+static inline void sst26_write_cmd(struct sst26_dev *dev, uint8_t cmd,
+                                   uint32_t address);
+static int sst26_flash_write(const struct hal_flash *hal_flash_dev,
+                             uint32_t addr, const void *buf, uint32_t len);
 
-/*
 static const struct hal_flash_funcs sst26_flash_funcs = {
     .hff_read         = sst26_read,
-    .hff_write        = sst26_write,
+    .hff_write        = sst26_flash_write,
     .hff_erase_sector = sst26_erase_sector,
     .hff_sector_info  = sst26_sector_info,
     .hff_init         = sst26_init,
 };
-*/
 
 static struct sst26_dev sst26_default_dev = {
     /* struct hal_flash for compatibility */
     .hal = {
-        .hf_itf        = NULL,
+        .hf_itf        = &sst26_flash_funcs,
         .hf_base_addr  = 0,
-        .hf_size       = 8192 * 512,
-        .hf_sector_cnt = 8192,
-        .hf_align      = 0,
+        .hf_size       = SST26_CHIP_SIZE,
+        .hf_sector_cnt = SST26_CHIP_SIZE / SST26_SECTOR_SIZE,
+        .hf_align      = 1,
     },
 
     /* SPI settings + updates baudrate on _init */
@@ -80,25 +72,274 @@ static struct hal_spi_settings sst26_default_settings = {
     .word_size  = HAL_SPI_WORD_SIZE_8BIT,
 };
 
-static uint8_t g_page_buffer[MAX_PAGE_SIZE];
+/**
+ * Typical and maximum duration of the chip operations, from the datasheet.
+ * The last entry is used when waiting on an operation the driver did not
+ * start itself, e.g. one still running from before a reset.
+ */
+struct sst26_op_time {
+    uint8_t op;
+    uint32_t typ_us;
+    uint32_t max_us;
+};
+
+static const struct sst26_op_time sst26_op_times[] = {
+    { PP,     500,   1500 },
+    { SE,   18000,  25000 },
+    { BE,   18000,  25000 },
+    { CE,   35000,  50000 },
+    { 0,        0,  50000 },
+};
+
+/* Status polling period once a short operation is due */
+#define SST26_POLL_US   50
+
+/* Suspend latency, 10 us max, polled for up to ten times that */
+#define SST26_SUSPEND_US        10
+#define SST26_SUSPEND_POLLS     10
+
+/* Erase time granted between a resume and the next suspend */
+#define SST26_RESUME_RUN_US     500
+
+/*
+ * Activity of the driver, "sst26" over newtmgr. The *_lat_* entries are a
+ * latency histogram per opcode: up to 100 us, 1 ms, 10 ms, 100 ms and
+ * beyond. Reads are timed from the command to the last byte, programs and
+ * erases from the command to the end of busy, suspended time excluded.
+ */
+STATS_SECT_START(sst26_stats)
+    STATS_SECT_ENTRY(reads)
+    STATS_SECT_ENTRY(read_bytes)
+    STATS_SECT_ENTRY(writes)
+    STATS_SECT_ENTRY(write_bytes)
+    STATS_SECT_ENTRY(page_programs)
+    STATS_SECT_ENTRY(program_bytes)
+    STATS_SECT_ENTRY(sector_erases)
+    STATS_SECT_ENTRY(block_erases)
+    STATS_SECT_ENTRY(chip_erases)
+    STATS_SECT_ENTRY(rmw_sectors)
+    STATS_SECT_ENTRY(rmw_pages)
+    STATS_SECT_ENTRY(busy_us)
+    STATS_SECT_ENTRY(polls)
+    STATS_SECT_ENTRY(sleeps)
+    STATS_SECT_ENTRY(timeouts)
+    STATS_SECT_ENTRY(suspends)
+    STATS_SECT_ENTRY(suspend_errors)
+    STATS_SECT_ENTRY(cache_hits)
+    STATS_SECT_ENTRY(cache_misses)
+    STATS_SECT_ENTRY(spi_xfers)
+
+    STATS_SECT_ENTRY(read_lat_100us)
+    STATS_SECT_ENTRY(read_lat_1ms)
+    STATS_SECT_ENTRY(read_lat_10ms)
+    STATS_SECT_ENTRY(read_lat_100ms)
+    STATS_SECT_ENTRY(read_lat_max)
+    STATS_SECT_ENTRY(pp_lat_100us)
+    STATS_SECT_ENTRY(pp_lat_1ms)
+    STATS_SECT_ENTRY(pp_lat_10ms)
+    STATS_SECT_ENTRY(pp_lat_100ms)
+    STATS_SECT_ENTRY(pp_lat_max)
+    STATS_SECT_ENTRY(se_lat_100us)
+    STATS_SECT_ENTRY(se_lat_1ms)
+    STATS_SECT_ENTRY(se_lat_10ms)
+    STATS_SECT_ENTRY(se_lat_100ms)
+    STATS_SECT_ENTRY(se_lat_max)
+    STATS_SECT_ENTRY(be_lat_100us)
+    STATS_SECT_ENTRY(be_lat_1ms)
+    STATS_SECT_ENTRY(be_lat_10ms)
+    STATS_SECT_ENTRY(be_lat_100ms)
+    STATS_SECT_ENTRY(be_lat_max)
+    STATS_SECT_ENTRY(ce_lat_100us)
+    STATS_SECT_ENTRY(ce_lat_1ms)
+    STATS_SECT_ENTRY(ce_lat_10ms)
+    STATS_SECT_ENTRY(ce_lat_100ms)
+    STATS_SECT_ENTRY(ce_lat_max)
+STATS_SECT_END
+
+STATS_NAME_START(sst26_stats)
+    STATS_NAME(sst26_stats, reads)
+    STATS_NAME(sst26_stats, read_bytes)
+    STATS_NAME(sst26_stats, writes)
+    STATS_NAME(sst26_stats, write_bytes)
+    STATS_NAME(sst26_stats, page_programs)
+    STATS_NAME(sst26_stats, program_bytes)
+    STATS_NAME(sst26_stats, sector_erases)
+    STATS_NAME(sst26_stats, block_erases)
+    STATS_NAME(sst26_stats, chip_erases)
+    STATS_NAME(sst26_stats, rmw_sectors)
+    STATS_NAME(sst26_stats, rmw_pages)
+    STATS_NAME(sst26_stats, busy_us)
+    STATS_NAME(sst26_stats, polls)
+    STATS_NAME(sst26_stats, sleeps)
+    STATS_NAME(sst26_stats, timeouts)
+    STATS_NAME(sst26_stats, suspends)
+    STATS_NAME(sst26_stats, suspend_errors)
+    STATS_NAME(sst26_stats, cache_hits)
+    STATS_NAME(sst26_stats, cache_misses)
+    STATS_NAME(sst26_stats, spi_xfers)
+
+    STATS_NAME(sst26_stats, read_lat_100us)
+    STATS_NAME(sst26_stats, read_lat_1ms)
+    STATS_NAME(sst26_stats, read_lat_10ms)
+    STATS_NAME(sst26_stats, read_lat_100ms)
+    STATS_NAME(sst26_stats, read_lat_max)
+    STATS_NAME(sst26_stats, pp_lat_100us)
+    STATS_NAME(sst26_stats, pp_lat_1ms)
+    STATS_NAME(sst26_stats, pp_lat_10ms)
+    STATS_NAME(sst26_stats, pp_lat_100ms)
+    STATS_NAME(sst26_stats, pp_lat_max)
+    STATS_NAME(sst26_stats, se_lat_100us)
+    STATS_NAME(sst26_stats, se_lat_1ms)
+    STATS_NAME(sst26_stats, se_lat_10ms)
+    STATS_NAME(sst26_stats, se_lat_100ms)
+    STATS_NAME(sst26_stats, se_lat_max)
+    STATS_NAME(sst26_stats, be_lat_100us)
+    STATS_NAME(sst26_stats, be_lat_1ms)
+    STATS_NAME(sst26_stats, be_lat_10ms)
+    STATS_NAME(sst26_stats, be_lat_100ms)
+    STATS_NAME(sst26_stats, be_lat_max)
+    STATS_NAME(sst26_stats, ce_lat_100us)
+    STATS_NAME(sst26_stats, ce_lat_1ms)
+    STATS_NAME(sst26_stats, ce_lat_10ms)
+    STATS_NAME(sst26_stats, ce_lat_100ms)
+    STATS_NAME(sst26_stats, ce_lat_max)
+STATS_NAME_END(sst26_stats)
+
+static STATS_SECT_DECL(sst26_stats) g_sst26_stats;
+static uint8_t g_sst26_initialized;
+
+#define SST26_STATS_LAT(__op, __bucket)                                 \
+    switch (__bucket) {                                                 \
+    case 0: STATS_INC(g_sst26_stats, __op ## _lat_100us); break;       \
+    case 1: STATS_INC(g_sst26_stats, __op ## _lat_1ms); break;         \
+    case 2: STATS_INC(g_sst26_stats, __op ## _lat_10ms); break;        \
+    case 3: STATS_INC(g_sst26_stats, __op ## _lat_100ms); break;       \
+    default: STATS_INC(g_sst26_stats, __op ## _lat_max); break;        \
+    }
+
+static void
+sst26_stats_latency(uint8_t op, uint32_t usecs)
+{
+    int bucket;
+
+    bucket = 0;
+    while (bucket < 4 && usecs >= 100) {
+        usecs /= 10;
+        bucket++;
+    }
+
+    switch (op) {
+    case READ:
+        SST26_STATS_LAT(read, bucket);
+        break;
+    case PP:
+        SST26_STATS_LAT(pp, bucket);
+        break;
+    case SE:
+        SST26_STATS_LAT(se, bucket);
+        break;
+    case BE:
+        SST26_STATS_LAT(be, bucket);
+        break;
+    case CE:
+        SST26_STATS_LAT(ce, bucket);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Image of the sector being rewritten by sst26_write() */
+static uint8_t g_sector_buffer[SST26_SECTOR_SIZE];
+static struct os_mutex g_sector_lock;
+
+#if MYNEWT_VAL(SST26_CACHE_PAGES) > 0
+/**
+ * LRU cache of whole pages for the reads of a page or less: headers and
+ * other metadata read over and over. Bulk reads and streams bypass it.
+ * Every program and erase drops the pages it touches, see sst26_op_start().
+ *
+ * Pages belong to the chip, not to the device: an application may set up
+ * several sst26_dev for the same SPI bus and chip select, what one of them
+ * writes must not leave stale pages to the others.
+ */
+struct sst26_cache_page {
+    uint8_t valid;
+    int spi_num;                    /* Chip of the page */
+    int ss_pin;
+    uint32_t addr;
+    uint32_t used;                  /* LRU stamp */
+    uint8_t data[SST26_PAGE_SIZE];
+};
+
+static struct sst26_cache_page g_cache[MYNEWT_VAL(SST26_CACHE_PAGES)];
+static uint32_t g_cache_stamp;
+
+static int sst26_cache_read(struct sst26_dev *dev, uint32_t addr,
+                            uint8_t *buf, uint32_t len);
+static void sst26_cache_invalidate(struct sst26_dev *dev, uint32_t addr,
+                                   uint32_t len);
+#endif
+
+/**
+ * Bus access. With SST26_SIM the SPI bus and the chip select are replaced
+ * by the RAM-backed model of SST26_sim.c.
+ */
+static inline void
+sst26_select(struct sst26_dev *dev)
+{
+#if MYNEWT_VAL(SST26_SIM)
+    sst26_sim_select();
+#else
+    hal_gpio_write(dev->ss_pin, 0);
+#endif
+}
+
+static inline void
+sst26_deselect(struct sst26_dev *dev)
+{
+#if MYNEWT_VAL(SST26_SIM)
+    sst26_sim_deselect();
+#else
+    hal_gpio_write(dev->ss_pin, 1);
+#endif
+}
+
+static inline void
+sst26_txrx(struct sst26_dev *dev, void *txbuf, void *rxbuf, int len)
+{
+    STATS_INC(g_sst26_stats, spi_xfers);
+#if MYNEWT_VAL(SST26_SIM)
+    sst26_sim_txrx(txbuf, rxbuf, len);
+#else
+    hal_spi_txrx(dev->spi_num, txbuf, rxbuf, len);
+#endif
+}
+
+static inline uint8_t
+sst26_tx_val(struct sst26_dev *dev, uint8_t val)
+{
+    sst26_txrx(dev, &val, &val, 1);
+    return val;
+}
 
 static uint8_t
 sst26_read_status(struct sst26_dev *dev)
 {
     uint8_t val;
 
-    hal_gpio_write(dev->ss_pin, 0);
+    sst26_select(dev);
 
-    hal_spi_tx_val(dev->spi_num, STATUS_REGISTER);
-    val = hal_spi_tx_val(dev->spi_num, 0xff);
+    sst26_tx_val(dev, STATUS_REGISTER);
+    val = sst26_tx_val(dev, 0xff);
 
-    hal_gpio_write(dev->ss_pin, 1);
+    sst26_deselect(dev);
 
     return val;
 }
 
 static inline bool
-sst26_device_ready(struct sst26_dev *dev)
+sst26_device_busy(struct sst26_dev *dev)
 {
     return ((sst26_read_status(dev) & STATUS_BUSY) != 0);
 }
@@ -106,181 +347,853 @@ sst26_device_ready(struct sst26_dev *dev)
 static inline void
 sst26_write_enable(struct sst26_dev *dev)
 {
-    hal_gpio_write(dev->ss_pin, 0);
-    hal_spi_tx_val(dev->spi_num, WREN);
-    hal_gpio_write(dev->ss_pin, 1);
+    sst26_select(dev);
+    sst26_tx_val(dev, WREN);
+    sst26_deselect(dev);
 
 }
 
+/**
+ * Send an opcode followed by a 24-bit address in a single SPI transfer.
+ * Chip select must already be asserted by the caller.
+ */
 static inline void
-sst26_write_address(struct sst26_dev *dev, uint32_t address)
-{    
-    uint8_t addr_hi = address >> 16;
-    uint8_t addr_mi = ( address & 0x00FF00 ) >> 8;
-    uint8_t addr_lo = ( address & 0x0000FF );
+sst26_write_cmd(struct sst26_dev *dev, uint8_t cmd, uint32_t address)
+{
+    uint8_t cmd_buf[4];
 
-    hal_spi_tx_val(dev->spi_num, addr_hi);
-    hal_spi_tx_val(dev->spi_num, addr_mi);
-    hal_spi_tx_val(dev->spi_num, addr_lo);
+    cmd_buf[0] = cmd;
+    cmd_buf[1] = address >> 16;
+    cmd_buf[2] = ( address & 0x00FF00 ) >> 8;
+    cmd_buf[3] = ( address & 0x0000FF );
 
+    sst26_txrx(dev, cmd_buf, NULL, sizeof(cmd_buf));
+}
+
+/*
+ * Bus lock. It is recursive, bus_depth counts the nesting of the owner so
+ * sst26_bus_sleep() can let go of it entirely.
+ */
+static void
+sst26_lock(struct sst26_dev *dev)
+{
+    os_mutex_pend(&dev->bus_lock, OS_TIMEOUT_NEVER);
+    dev->bus_depth++;
+}
+
+static void
+sst26_unlock(struct sst26_dev *dev)
+{
+    dev->bus_depth--;
+    os_mutex_release(&dev->bus_lock);
+}
+
+/**
+ * Remember a program or erase was just started and the area it works on.
+ * sst26_wait_ready() uses it to know how long to sleep before polling,
+ * sst26_read_prepare() to know what can still be read.
+ */
+static inline void
+sst26_op_start(struct sst26_dev *dev, uint8_t op, uint32_t addr)
+{
+    dev->busy_op = op;
+    dev->busy_start = os_cputime_get32();
+    dev->resume_time = dev->busy_start;
+
+    switch (op) {
+    case PP:
+        dev->busy_addr = addr & ~(SST26_PAGE_SIZE - 1);
+        dev->busy_size = SST26_PAGE_SIZE;
+        STATS_INC(g_sst26_stats, page_programs);
+        break;
+    case SE:
+        dev->busy_addr = addr & ~(SST26_SECTOR_SIZE - 1);
+        dev->busy_size = SST26_SECTOR_SIZE;
+        STATS_INC(g_sst26_stats, sector_erases);
+        break;
+    case BE:
+        sst26_block_bounds(addr, &dev->busy_addr, &dev->busy_size);
+        STATS_INC(g_sst26_stats, block_erases);
+        break;
+    default:
+        dev->busy_addr = 0;
+        dev->busy_size = SST26_CHIP_SIZE;
+        STATS_INC(g_sst26_stats, chip_erases);
+        break;
+    }
+
+#if MYNEWT_VAL(SST26_CACHE_PAGES) > 0
+    sst26_cache_invalidate(dev, dev->busy_addr, dev->busy_size);
+#endif
 }
 
-/* FIXME: add timeout */
 static inline void
+sst26_op_done(struct sst26_dev *dev)
+{
+    uint32_t usecs;
+
+    usecs = os_cputime_ticks_to_usecs(os_cputime_get32() - dev->busy_start);
+    STATS_INCN(g_sst26_stats, busy_us, usecs);
+    sst26_stats_latency(dev->busy_op, usecs);
+    dev->busy_op = 0;
+}
+
+static const struct sst26_op_time *
+sst26_op_time(uint8_t op)
+{
+    const struct sst26_op_time *t;
+
+    for (t = sst26_op_times; t->op != 0; t++) {
+        if (t->op == op) {
+            break;
+        }
+    }
+    return t;
+}
+
+static inline int
+sst26_busy_overlaps(struct sst26_dev *dev, uint32_t addr, uint32_t len)
+{
+    return addr < dev->busy_addr + dev->busy_size &&
+           dev->busy_addr < addr + len;
+}
+
+static void
+sst26_resume(struct sst26_dev *dev)
+{
+    uint32_t now;
+
+    sst26_select(dev);
+    sst26_tx_val(dev, WRESU);
+    sst26_deselect(dev);
+
+    /* The erase did not progress while suspended */
+    now = os_cputime_get32();
+    dev->busy_start += now - dev->suspend_start;
+    dev->resume_time = now;
+    dev->suspended = 0;
+}
+
+/**
+ * Suspend the running sector or block erase so the rest of the array can
+ * be read. Returns 0 when the array is readable outside of the erased
+ * area, -1 if the chip didn't enter suspend in time.
+ */
+static int
+sst26_suspend(struct sst26_dev *dev)
+{
+    uint32_t since;
+    uint8_t status;
+    int i;
+
+    if (!sst26_device_busy(dev)) {
+        sst26_op_done(dev);
+        return 0;
+    }
+
+    /* Back to back suspends would keep the erase from ever completing */
+    since = os_cputime_ticks_to_usecs(os_cputime_get32() - dev->resume_time);
+    if (since < SST26_RESUME_RUN_US) {
+        os_cputime_delay_usecs(SST26_RESUME_RUN_US - since);
+    }
+
+    sst26_select(dev);
+    sst26_tx_val(dev, WSUSP);
+    sst26_deselect(dev);
+    dev->suspend_start = os_cputime_get32();
+    dev->suspended = 1;
+
+    for (i = 0; i < SST26_SUSPEND_POLLS; i++) {
+        os_cputime_delay_usecs(SST26_SUSPEND_US);
+        status = sst26_read_status(dev);
+        if (!(status & STATUS_BUSY)) {
+            break;
+        }
+    }
+
+    /*
+     * Not suspended in time: the caller waits for the end of the erase,
+     * which never stopped, without a resume.
+     */
+    if (status & STATUS_BUSY) {
+        dev->suspended = 0;
+        STATS_INC(g_sst26_stats, suspend_errors);
+        return -1;
+    }
+
+    /* Completed before the suspend took effect */
+    if (!(status & STATUS_WSE)) {
+        dev->suspended = 0;
+        sst26_op_done(dev);
+        return 0;
+    }
+
+    STATS_INC(g_sst26_stats, suspends);
+    return 0;
+}
+
+/**
+ * Release the chip from an open stream and resume a suspended erase, so
+ * the bus can be used for something else.
+ */
+static void
+sst26_stream_detach(struct sst26_dev *dev)
+{
+    if (dev->stream) {
+        sst26_deselect(dev);
+        dev->stream = NULL;
+    }
+
+    if (dev->suspended) {
+        sst26_resume(dev);
+    }
+}
+
+/**
+ * Sleep without holding the bus, so other tasks can read the array while
+ * this one waits for the end of an erase.
+ */
+static void
+sst26_bus_sleep(struct sst26_dev *dev, os_time_t ticks)
+{
+    int depth;
+    int i;
+
+    depth = dev->bus_depth;
+    for (i = 0; i < depth; i++) {
+        sst26_unlock(dev);
+    }
+
+    os_time_delay(ticks);
+
+    for (i = 0; i < depth; i++) {
+        sst26_lock(dev);
+    }
+    sst26_stream_detach(dev);
+}
+
+/**
+ * Wait for the end of the running operation.
+ *
+ * The task sleeps through the typical duration of the operation, then
+ * polls the status register: every tick for the erases, every
+ * SST26_POLL_US for a page program which is shorter than a tick. The bus
+ * is released while sleeping. Gives up with -1 after twice the datasheet
+ * maximum.
+ */
+static int
 sst26_wait_ready(struct sst26_dev *dev)
 {
-    while (sst26_device_ready(dev)) {
-        os_time_delay(OS_TICKS_PER_SEC / 10000);
+    const struct sst26_op_time *t;
+    uint32_t entry;
+    uint32_t start;
+    uint32_t elapsed;
+    uint32_t ticks;
+    int rc;
+
+    if (dev->suspended) {
+        sst26_resume(dev);
+    }
+
+    entry = os_cputime_get32();
+    rc = 0;
+
+    while (1) {
+        /* Can change while sleeping, another task may have waited for it */
+        t = sst26_op_time(dev->busy_op);
+        start = dev->busy_op ? dev->busy_start : entry;
+
+        elapsed = os_cputime_ticks_to_usecs(os_cputime_get32() - start);
+        if (elapsed < t->typ_us) {
+            ticks = (uint64_t)(t->typ_us - elapsed) * OS_TICKS_PER_SEC / 1000000;
+            if (ticks) {
+                STATS_INC(g_sst26_stats, sleeps);
+                sst26_bus_sleep(dev, ticks);
+                continue;
+            }
+        }
+
+        STATS_INC(g_sst26_stats, polls);
+        if (!sst26_device_busy(dev)) {
+            break;
+        }
+
+        if (elapsed > 2 * t->max_us) {
+            STATS_INC(g_sst26_stats, timeouts);
+            rc = -1;
+            break;
+        }
+
+        if (t->max_us >= 1000000 / OS_TICKS_PER_SEC) {
+            STATS_INC(g_sst26_stats, sleeps);
+            sst26_bus_sleep(dev, 1);
+        } else {
+            os_cputime_delay_usecs(SST26_POLL_US);
+        }
+    }
+
+    if (dev->busy_op) {
+        sst26_op_done(dev);
+    }
+
+    return rc;
+}
+
+/**
+ * Make [addr, addr + len) readable: a sector or block erase elsewhere is
+ * suspended, anything else has to complete first.
+ */
+static int
+sst26_read_prepare(struct sst26_dev *dev, uint32_t addr, uint32_t len)
+{
+    if (dev->suspended) {
+        if (!sst26_busy_overlaps(dev, addr, len)) {
+            return 0;
+        }
+    } else if ((dev->busy_op == SE || dev->busy_op == BE) &&
+               !sst26_busy_overlaps(dev, addr, len) &&
+               sst26_suspend(dev) == 0) {
+        return 0;
+    }
+
+    return sst26_wait_ready(dev);
+}
+
+/**
+ * Take the SPI bus shared by the flash and the other devices on it.
+ *
+ * A stream left open is released and a suspended erase resumed, so the
+ * caller can talk to another device. The lock is recursive: the driver
+ * calls nest inside it.
+ */
+void
+sst26_bus_acquire(struct sst26_dev *dev)
+{
+    sst26_lock(dev);
+    sst26_stream_detach(dev);
+}
+
+void
+sst26_bus_release(struct sst26_dev *dev)
+{
+    /* An erase suspended for sst26_read_noblock() goes on with the bus */
+    if (dev->bus_depth == 1 && dev->suspended && !dev->stream &&
+        !dev->read_cb) {
+        sst26_resume(dev);
     }
+
+    sst26_unlock(dev);
 }
 
-// number of necessary page 
-static inline uint16_t
-sst26_calc_page_count(struct sst26_dev *dev, uint32_t addr, size_t len)
+#if !MYNEWT_VAL(SST26_SIM)
+/**
+ * SPI callback of the bus, installed once by sst26_init(): the transfers
+ * in the background are only started by the bus holder, whose callback
+ * gets the completion.
+ */
+static void
+sst26_bus_txrx_done(void *arg, int len)
 {
-    uint16_t page_count;
-    uint16_t page_size = dev->page_size;
+    struct sst26_dev *dev;
+    sst26_done_cb done_cb;
+
+    dev = (struct sst26_dev *) arg;
+
+    done_cb = dev->done_cb;
+    dev->done_cb = NULL;
+    if (done_cb) {
+        done_cb(dev->done_arg, len);
+    }
+}
+#endif
 
-    page_count = 1 + (len / (page_size + 1));
+/**
+ * Start a transfer in the background for another device of the bus. The
+ * caller holds the bus (see sst26_bus_acquire()) and keeps it until
+ * done_cb is called from the SPI interrupt.
+ *
+ * Returns -1 if the transfer can't go in the background, the caller then
+ * makes it with hal_spi_txrx().
+ */
+int
+sst26_bus_txrx_noblock(struct sst26_dev *dev, void *txbuf, void *rxbuf,
+                       int len, sst26_done_cb done_cb, void *arg)
+{
+#if MYNEWT_VAL(SST26_SIM)
+    return -1;
+#else
+    int rc;
 
-    // addr % page_size gives the number not use in a page 
-    if ((addr % page_size) + len > page_size * page_count) {
-        page_count++;
+    if (!dev->txrx_cb_set || dev->bus_depth == 0 || dev->done_cb) {
+        return -1;
     }
 
-    return page_count;
+    dev->done_arg = arg;
+    dev->done_cb = done_cb;
+
+    rc = hal_spi_txrx_noblock(dev->spi_num, txbuf, rxbuf, len);
+    if (rc) {
+        dev->done_cb = NULL;
+    }
+    return rc;
+#endif
 }
 
-static inline uint32_t
-sst26_page_start_address(struct sst26_dev *dev, uint32_t addr)
+/**
+ * Read from the array, the caller holds the bus.
+ */
+static int
+sst26_read_array(struct sst26_dev *dev, uint32_t addr, void *buf,
+                 uint32_t len)
 {
-    return (addr & ~(dev->page_size - 1)); // Page address: A[bit 23: bit 8]
+    uint32_t start;
+    int rc;
+
+    start = os_cputime_get32();
+
+    /* The array can't be read while a program or erase is running */
+    rc = sst26_read_prepare(dev, addr, len);
+    if (rc) {
+        return rc;
+    }
+
+    sst26_select(dev);
+
+    sst26_write_cmd(dev, READ, addr);
+
+    /**
+     * The flash ignores SI while it shifts data out, so the destination
+     * buffer doubles as the dummy transmit buffer.
+     */
+    sst26_txrx(dev, buf, buf, len);
+
+    sst26_deselect(dev);
+
+    sst26_stats_latency(READ,
+                        os_cputime_ticks_to_usecs(os_cputime_get32() - start));
+
+    return 0;
 }
 
-static inline uint32_t
-sst26_page_next_addr(struct sst26_dev *dev, uint32_t addr)
+#if MYNEWT_VAL(SST26_CACHE_PAGES) > 0
+static int
+sst26_cache_chip(const struct sst26_cache_page *p, const struct sst26_dev *dev)
 {
-    return (sst26_page_start_address(dev, addr) + dev->page_size);
+    return p->valid && p->spi_num == dev->spi_num && p->ss_pin == dev->ss_pin;
 }
 
+static void
+sst26_cache_invalidate(struct sst26_dev *dev, uint32_t addr, uint32_t len)
+{
+    struct sst26_cache_page *p;
+
+    for (p = g_cache; p < g_cache + MYNEWT_VAL(SST26_CACHE_PAGES); p++) {
+        if (sst26_cache_chip(p, dev) && p->addr < addr + len &&
+            addr < p->addr + SST26_PAGE_SIZE) {
+            p->valid = 0;
+        }
+    }
+}
+
+static int
+sst26_cache_read(struct sst26_dev *dev, uint32_t addr, uint8_t *buf,
+                 uint32_t len)
+{
+    struct sst26_cache_page *p;
+    struct sst26_cache_page *victim;
+    uint32_t page_addr;
+    uint32_t off;
+    uint32_t amount;
+    int rc;
+
+    while (len) {
+        page_addr = addr & ~(SST26_PAGE_SIZE - 1);
+        off = addr - page_addr;
+        amount = SST26_PAGE_SIZE - off;
+        if (amount > len) {
+            amount = len;
+        }
+
+        victim = g_cache;
+        for (p = g_cache; p < g_cache + MYNEWT_VAL(SST26_CACHE_PAGES); p++) {
+            if (sst26_cache_chip(p, dev) && p->addr == page_addr) {
+                break;
+            }
+            if (!p->valid || (victim->valid && p->used < victim->used)) {
+                victim = p;
+            }
+        }
+
+        if (p < g_cache + MYNEWT_VAL(SST26_CACHE_PAGES)) {
+            STATS_INC(g_sst26_stats, cache_hits);
+        } else {
+            STATS_INC(g_sst26_stats, cache_misses);
+            p = victim;
+            p->valid = 0;
+            rc = sst26_read_array(dev, page_addr, p->data, SST26_PAGE_SIZE);
+            if (rc) {
+                return rc;
+            }
+            p->valid = 1;
+            p->spi_num = dev->spi_num;
+            p->ss_pin = dev->ss_pin;
+            p->addr = page_addr;
+        }
+
+        p->used = ++g_cache_stamp;
+        memcpy(buf, p->data + off, amount);
+
+        addr += amount;
+        buf += amount;
+        len -= amount;
+    }
+
+    return 0;
+}
+#endif
 
 // FIXME: assume buf has enough space?
 int
 sst26_read(const struct hal_flash *hal_flash_dev, uint32_t addr, void *buf,
                 uint32_t len)
 {
-    uint16_t n;
     struct sst26_dev *dev;
-    uint8_t *u8buf;
-    uint16_t read = READ;
-
-    u8buf = (uint8_t *) buf;
+    int rc;
 
     dev = (struct sst26_dev *) hal_flash_dev;
 
-    hal_gpio_write(dev->ss_pin, 0);
+    if (len == 0) {
+        return 0;
+    }
 
-    hal_spi_tx_val(dev->spi_num, read);
+    STATS_INC(g_sst26_stats, reads);
+    STATS_INCN(g_sst26_stats, read_bytes, len);
 
-    sst26_write_address(dev, addr);
+    sst26_bus_acquire(dev);
 
-    for (n = 0; n < len; n++) {
-        u8buf[n] = hal_spi_tx_val(dev->spi_num, 0xff);
+#if MYNEWT_VAL(SST26_CACHE_PAGES) > 0
+    if (len <= SST26_PAGE_SIZE) {
+        rc = sst26_cache_read(dev, addr, buf, len);
+    } else {
+        rc = sst26_read_array(dev, addr, buf, len);
     }
+#else
+    rc = sst26_read_array(dev, addr, buf, len);
+#endif
 
-    hal_gpio_write(dev->ss_pin, 1);
+    if (dev->suspended) {
+        sst26_resume(dev);
+    }
 
-    return 0;
+    sst26_bus_release(dev);
+
+    return rc;
 }
 
-int
-sst26_write(const struct hal_flash *hal_flash_dev, uint32_t addr,
-        const void *buf, uint32_t len)
+#if !MYNEWT_VAL(SST26_SIM)
+/**
+ * End of the data phase of sst26_read_noblock(), from the SPI interrupt.
+ */
+static void
+sst26_read_noblock_done(void *arg, int len)
 {
-    uint16_t bfa;
-    uint32_t n;
-    uint32_t start_addr;
-    uint16_t index;
-    uint16_t amount;
-    int page_count;
-    uint8_t *u8buf;
-    uint16_t page_size;
     struct sst26_dev *dev;
+    sst26_done_cb read_cb;
 
-    dev = (struct sst26_dev *) hal_flash_dev;
+    dev = (struct sst26_dev *) arg;
 
-    page_size = dev->page_size;
-    page_count = sst26_calc_page_count(dev, addr, len);
-    u8buf = (uint8_t *) buf;
-    index = 0;
-
-    while (page_count--) {
-        sst26_wait_ready(dev);
-
-        bfa = addr % page_size;
-        start_addr = sst26_page_start_address(dev, addr);
-
-        /**
-         * If the page is not being written from the beginning,
-         * read first the current data to rewrite back.
-         *
-         * The whole page is read here for the case of some the
-         * real data ending before the end of the page, data must
-         * be written back again.
-         */
-        if (bfa || len < page_size) {
-            sst26_read(hal_flash_dev, start_addr, g_page_buffer,page_size);
-            sst26_wait_ready(dev);
+    sst26_deselect(dev);
+
+    read_cb = dev->read_cb;
+    dev->read_cb = NULL;
+    read_cb(dev->read_arg, len);
+}
+#endif
+
+/**
+ * Same as sst26_read() with the data phase in the background, so the task
+ * can prepare what comes next while the bytes come in.
+ *
+ * The caller holds the bus (see sst26_bus_acquire()) from before the call
+ * until done_cb is called from the SPI interrupt, the chip is deselected
+ * by then. An erase elsewhere is suspended like for sst26_read(), and
+ * resumed by sst26_bus_release(). With SST26_SIM the read completes
+ * before the call returns.
+ *
+ * Returns -1 if the read can't go in the background, the caller then
+ * uses sst26_read().
+ */
+int
+sst26_read_noblock(struct sst26_dev *dev, uint32_t addr, void *buf,
+                   uint32_t len, sst26_done_cb done_cb, void *arg)
+{
+    int rc;
+
+    if (len == 0 || addr + len > dev->hal.hf_size || dev->bus_depth == 0 ||
+        dev->read_cb) {
+        return -1;
+    }
+
+    sst26_lock(dev);
+
+    sst26_stream_detach(dev);
+    rc = sst26_read_prepare(dev, addr, len);
+    if (rc) {
+        sst26_unlock(dev);
+        return rc;
+    }
+
+    sst26_select(dev);
+    sst26_write_cmd(dev, READ, addr);
+
+#if MYNEWT_VAL(SST26_SIM)
+    sst26_txrx(dev, buf, buf, len);
+    sst26_deselect(dev);
+    done_cb(arg, len);
+#else
+    dev->read_arg = arg;
+    dev->read_cb = done_cb;
+
+    /* The flash ignores SI while it shifts data out, see sst26_read_array() */
+    rc = sst26_bus_txrx_noblock(dev, buf, buf, len, sst26_read_noblock_done,
+                                dev);
+    if (rc) {
+        dev->read_cb = NULL;
+        sst26_deselect(dev);
+        sst26_unlock(dev);
+        return rc;
+    }
+#endif
+
+    STATS_INC(g_sst26_stats, reads);
+    STATS_INCN(g_sst26_stats, read_bytes, len);
+
+    sst26_unlock(dev);
+
+    return 0;
+}
+
+/**
+ * Program len bytes at addr, one page program per page touched. The target
+ * area must be erased or only need 1 -> 0 bit changes.
+ */
+static int
+sst26_program(struct sst26_dev *dev, uint32_t addr, const uint8_t *src,
+              uint32_t len)
+{
+    uint32_t amount;
+
+    while (len) {
+        amount = dev->page_size - (addr % dev->page_size);
+        if (amount > len) {
+            amount = len;
         }
 
+        sst26_bus_acquire(dev);
+
+        if (sst26_wait_ready(dev)) {
+            sst26_bus_release(dev);
+            return -1;
+        }
 
         sst26_write_enable(dev);   // Enable write
-        hal_gpio_write(dev->ss_pin, 0);
+        sst26_select(dev);
+        sst26_write_cmd(dev, PP, addr); // Page programm command
+        sst26_txrx(dev, (void *) src, NULL, amount);
+        sst26_deselect(dev);
+        sst26_op_start(dev, PP, addr);
+        STATS_INCN(g_sst26_stats, program_bytes, amount);
+
+        sst26_bus_release(dev);
+
+        addr += amount;
+        src += amount;
+        len -= amount;
+    }
+
+    return 0;
+}
 
-        /* TODO: ping-pong between page 1 and 2? */
-        hal_spi_tx_val(dev->spi_num, PP); // Page programm command
+/**
+ * Write len bytes at offset off of the sector starting at sector_addr.
+ *
+ * The current content is compared with the new data first:
+ *  - nothing changes: nothing is written,
+ *  - only 1 -> 0 bit changes: the differing pages are programmed directly,
+ *  - otherwise the rest of the sector is read back, the sector is erased
+ *    and every page that isn't blank is programmed again.
+ */
+static int
+sst26_write_sector(struct sst26_dev *dev, uint32_t sector_addr, uint32_t off,
+                   const uint8_t *src, uint32_t len)
+{
+    uint8_t *sbuf;
+    uint32_t page_size;
+    uint32_t amount;
+    uint32_t end;
+    uint32_t i;
+    int dirty;
+    int need_erase;
+
+    sbuf = g_sector_buffer;
+    page_size = dev->page_size;
+    end = off + len;
 
-        sst26_write_address(dev, start_addr); // start address of the page
+    if (sst26_read(&dev->hal, sector_addr + off, sbuf + off, len)) {
+        return -1;
+    }
 
-        /**
-         * Write back extra stuff at the beginning of page.
-         */
-        if (bfa) {
-            amount = addr - start_addr;
-            for (n = 0; n < amount; n++) {
-                hal_spi_tx_val(dev->spi_num, g_page_buffer[n]);
+    dirty = 0;
+    need_erase = 0;
+    for (i = 0; i < len; i++) {
+        if (sbuf[off + i] != src[i]) {
+            dirty = 1;
+            if ((sbuf[off + i] & src[i]) != src[i]) {
+                need_erase = 1;
+                break;
             }
         }
+    }
 
-        if (len + bfa <= page_size) {
-            amount = len;
-        } else {
-            amount = page_size - bfa;
-        }
+    if (!dirty) {
+        return 0;
+    }
 
-        /**
-         * Data we want to write!
-         */
-        for (n = 0; n < amount; n++) {
-            hal_spi_tx_val(dev->spi_num, u8buf[index++]);
+    if (!need_erase) {
+        /* Skip the pages already holding the right data */
+        for (i = off; i < end; i += amount) {
+            amount = page_size - (i % page_size);
+            if (amount > end - i) {
+                amount = end - i;
+            }
+            if (memcmp(sbuf + i, src + (i - off), amount) &&
+                sst26_program(dev, sector_addr + i, src + (i - off), amount)) {
+                return -1;
+            }
         }
+        return 0;
+    }
+
+    /* Keep what is around the new data, it is lost with the erase */
+    if (off && sst26_read(&dev->hal, sector_addr, sbuf, off)) {
+        return -1;
+    }
+    if (end < SST26_SECTOR_SIZE &&
+        sst26_read(&dev->hal, sector_addr + end, sbuf + end,
+                   SST26_SECTOR_SIZE - end)) {
+        return -1;
+    }
+    memcpy(sbuf + off, src, len);
+
+    STATS_INC(g_sst26_stats, rmw_sectors);
+
+    if (sst26_sector_erase(&dev->hal, sector_addr)) {
+        return -1;
+    }
 
-        /**
-         * Write back extra stuff at the ending of page.
-         */
-        if (bfa + len < page_size) {
-            for (n = len + bfa; n < page_size; n++) {
-                hal_spi_tx_val(dev->spi_num, g_page_buffer[n]);
+    for (i = 0; i < SST26_SECTOR_SIZE; i += page_size) {
+        for (amount = 0; amount < page_size; amount++) {
+            if (sbuf[i + amount] != 0xff) {
+                break;
             }
         }
+        if (amount == page_size) {
+            continue;
+        }
+        /* Pages holding none of the new data only come back from sbuf */
+        if (i + page_size <= off || i >= end) {
+            STATS_INC(g_sst26_stats, rmw_pages);
+        }
+        if (sst26_program(dev, sector_addr + i, sbuf + i, page_size)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * hal_flash interface: plain programming, as with the internal flash.
+ * FCB and the other hal_flash users erase the sectors themselves before
+ * appending, so the read back of sst26_write() would only cost time.
+ */
+static int
+sst26_flash_write(const struct hal_flash *hal_flash_dev, uint32_t addr,
+                  const void *buf, uint32_t len)
+{
+    struct sst26_dev *dev;
+
+    dev = (struct sst26_dev *) hal_flash_dev;
 
-        hal_gpio_write(dev->ss_pin, 1);
+    if (addr + len > dev->hal.hf_size || addr + len < addr) {
+        return -1;
+    }
+
+    STATS_INC(g_sst26_stats, writes);
+    STATS_INCN(g_sst26_stats, write_bytes, len);
+
+    return sst26_program(dev, addr, buf, len);
+}
+
+/**
+ * Write any amount of data at any address.
+ *
+ * Each 4 KB sector touched is handled on its own so an update only costs
+ * an erase of the sectors which really need one. With disable_auto_erase
+ * set the data is programmed as is and the caller is responsible for
+ * erasing first.
+ */
+int
+sst26_write(const struct hal_flash *hal_flash_dev, uint32_t addr,
+        const void *buf, uint32_t len)
+{
+    uint32_t sector_addr;
+    uint32_t off;
+    uint32_t amount;
+    const uint8_t *u8buf;
+    struct sst26_dev *dev;
+    int rc;
 
-        addr = sst26_page_next_addr(dev, addr);
+    dev = (struct sst26_dev *) hal_flash_dev;
+
+    if (addr + len > dev->hal.hf_size || addr + len < addr) {
+        return -1;
+    }
+
+    u8buf = (const uint8_t *) buf;
+    rc = 0;
+
+    STATS_INC(g_sst26_stats, writes);
+    STATS_INCN(g_sst26_stats, write_bytes, len);
+
+    /* The sector buffer is shared, the bus is taken per command */
+    os_mutex_pend(&g_sector_lock, OS_TIMEOUT_NEVER);
+
+    while (len) {
+        sector_addr = addr & ~(SST26_SECTOR_SIZE - 1);
+        off = addr - sector_addr;
+        amount = SST26_SECTOR_SIZE - off;
+        if (amount > len) {
+            amount = len;
+        }
+
+        if (dev->disable_auto_erase) {
+            rc = sst26_program(dev, addr, u8buf, amount);
+        } else {
+            rc = sst26_write_sector(dev, sector_addr, off, u8buf, amount);
+        }
+        if (rc) {
+            break;
+        }
+
+        addr += amount;
+        u8buf += amount;
         len -= amount;
     }
 
-    return 0;
+    os_mutex_release(&g_sector_lock);
+
+    return rc;
 }
 
 int
@@ -288,16 +1201,101 @@ sst26_sector_erase(const struct hal_flash *hal_flash_dev,
                     uint32_t sector_address)
 {
     struct sst26_dev *dev;
+    int rc;
     
     dev = (struct sst26_dev *) hal_flash_dev;
 
-    sst26_wait_ready(dev);
+    sst26_bus_acquire(dev);
 
-    sst26_write_enable(dev);   // Enable write
-    hal_gpio_write(dev->ss_pin, 0);
-    hal_spi_tx_val(dev->spi_num, SE);
-    sst26_write_address(dev, sector_address);
-    hal_gpio_write(dev->ss_pin, 1);
+    rc = sst26_wait_ready(dev);
+    if (rc == 0) {
+        sst26_write_enable(dev);   // Enable write
+        sst26_select(dev);
+        sst26_write_cmd(dev, SE, sector_address);
+        sst26_deselect(dev);
+        sst26_op_start(dev, SE, sector_address);
+    }
+
+    sst26_bus_release(dev);
+
+    return rc;
+}
+
+/**
+ * Erase [addr, addr + len) with as few commands as possible.
+ *
+ * Both ends must be on a 4 KB sector boundary. The range is covered with
+ * whole blocks of the SST26VF032B map (8, 32 or 64 KB) wherever they fit
+ * and 4 KB sectors at the edges; a block erase takes the same time as a
+ * sector erase. The whole chip is cleared with a single chip erase.
+ */
+int
+sst26_erase_range(const struct hal_flash *hal_flash_dev, uint32_t addr,
+                  uint32_t len)
+{
+    struct sst26_dev *dev;
+    uint32_t end;
+    uint32_t start;
+    uint32_t size;
+    int rc;
+
+    dev = (struct sst26_dev *) hal_flash_dev;
+    end = addr + len;
+
+    if ((addr | len) & (SST26_SECTOR_SIZE - 1) ||
+        end > dev->hal.hf_size || end < addr) {
+        return -1;
+    }
+
+    if (addr == 0 && len == SST26_CHIP_SIZE) {
+        return sst26_chip_erase(hal_flash_dev);
+    }
+
+    rc = 0;
+
+    /* Each erase takes the bus on its own, readers get in between */
+    while (addr < end && rc == 0) {
+        sst26_block_bounds(addr, &start, &size);
+        if (start == addr && end - addr >= size) {
+            rc = sst26_block_erase(hal_flash_dev, addr);
+        } else {
+            size = SST26_SECTOR_SIZE;
+            rc = sst26_sector_erase(hal_flash_dev, addr);
+        }
+        addr += size;
+    }
+
+    return rc;
+}
+
+/**
+ * hal_flash interface: erase the 4 KB sector at sector_address.
+ */
+int
+sst26_erase_sector(const struct hal_flash *hal_flash_dev,
+                   uint32_t sector_address)
+{
+    if (sector_address & (SST26_SECTOR_SIZE - 1) ||
+        sector_address >= hal_flash_dev->hf_size) {
+        return -1;
+    }
+
+    return sst26_sector_erase(hal_flash_dev, sector_address);
+}
+
+/**
+ * hal_flash interface: the chip is a flat array of 4 KB sectors.
+ */
+int
+sst26_sector_info(const struct hal_flash *hal_flash_dev, int idx,
+                  uint32_t *address, uint32_t *sz)
+{
+    if (idx < 0 || idx >= hal_flash_dev->hf_sector_cnt) {
+        return -1;
+    }
+
+    *address = hal_flash_dev->hf_base_addr + idx * SST26_SECTOR_SIZE;
+    *sz = SST26_SECTOR_SIZE;
 
     return 0;
 }
@@ -307,37 +1305,303 @@ sst26_block_erase(const struct hal_flash *hal_flash_dev,
                     uint32_t block_address)
 {
     struct sst26_dev *dev;
+    int rc;
     
     dev = (struct sst26_dev *) hal_flash_dev;
-    
-    sst26_wait_ready(dev);
 
-    sst26_write_enable(dev);   // Enable write
-    hal_gpio_write(dev->ss_pin, 0);
-    hal_spi_tx_val(dev->spi_num, BE);
-    sst26_write_address(dev, block_address);
-    hal_gpio_write(dev->ss_pin, 1);
+    sst26_bus_acquire(dev);
 
-    return 0;
+    rc = sst26_wait_ready(dev);
+    if (rc == 0) {
+        sst26_write_enable(dev);   // Enable write
+        sst26_select(dev);
+        sst26_write_cmd(dev, BE, block_address);
+        sst26_deselect(dev);
+        sst26_op_start(dev, BE, block_address);
+    }
+
+    sst26_bus_release(dev);
+
+    return rc;
 }
 
 int
 sst26_chip_erase(const struct hal_flash *hal_flash_dev)
 {
     struct sst26_dev *dev;
+    int rc;
     
     dev = (struct sst26_dev *) hal_flash_dev;
-    
-    sst26_wait_ready(dev);
-    
-    sst26_write_enable(dev);   // Enable write
-    hal_gpio_write(dev->ss_pin, 0);
-    hal_spi_tx_val(dev->spi_num, CE);
-    hal_gpio_write(dev->ss_pin, 1);
+
+    sst26_bus_acquire(dev);
+
+    rc = sst26_wait_ready(dev);
+    if (rc == 0) {
+        sst26_write_enable(dev);   // Enable write
+        sst26_select(dev);
+        sst26_tx_val(dev, CE);
+        sst26_deselect(dev);
+        sst26_op_start(dev, CE, 0);
+    }
+
+    sst26_bus_release(dev);
+
+    return rc;
+}
+
+/**
+ * Open a read cursor at addr.
+ *
+ * sst26_stream_read() keeps the chip selected in one READ transaction
+ * between calls, so the opcode and the address are only sent again when
+ * another bus user took the bus in between. A sector or block erase is
+ * kept suspended while the stream holds the chip.
+ */
+int
+sst26_stream_open(struct sst26_dev *dev, struct sst26_stream *stream,
+                  uint32_t addr)
+{
+    if (addr >= dev->hal.hf_size) {
+        return -1;
+    }
+
+    stream->dev = dev;
+    stream->addr = addr;
 
     return 0;
 }
 
+int
+sst26_stream_read(struct sst26_stream *stream, void *buf, uint32_t len)
+{
+    struct sst26_dev *dev;
+    uint32_t start;
+    int rc;
+
+    dev = stream->dev;
+
+    if (stream->addr + len > dev->hal.hf_size) {
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+
+    start = os_cputime_get32();
+
+    sst26_lock(dev);
+
+    rc = 0;
+    if (dev->stream != stream ||
+        (dev->suspended && sst26_busy_overlaps(dev, stream->addr, len))) {
+        sst26_stream_detach(dev);
+
+        rc = sst26_read_prepare(dev, stream->addr, len);
+        if (rc == 0) {
+            sst26_select(dev);
+            sst26_write_cmd(dev, READ, stream->addr);
+            dev->stream = stream;
+        }
+    }
+
+    if (rc == 0) {
+        sst26_txrx(dev, buf, buf, len);
+        stream->addr += len;
+
+        STATS_INC(g_sst26_stats, reads);
+        STATS_INCN(g_sst26_stats, read_bytes, len);
+        sst26_stats_latency(READ,
+                            os_cputime_ticks_to_usecs(os_cputime_get32() - start));
+    }
+
+    sst26_unlock(dev);
+
+    return rc;
+}
+
+void
+sst26_stream_close(struct sst26_stream *stream)
+{
+    struct sst26_dev *dev;
+
+    dev = stream->dev;
+
+    sst26_lock(dev);
+
+    if (dev->stream == stream) {
+        sst26_stream_detach(dev);
+    }
+
+    sst26_unlock(dev);
+}
+
+#if MYNEWT_VAL(SST26_BENCH)
+static uint32_t
+sst26_bench_bps(uint32_t bytes, uint32_t start)
+{
+    uint32_t usecs;
+
+    usecs = os_cputime_ticks_to_usecs(os_cputime_get32() - start);
+    if (usecs == 0) {
+        usecs = 1;
+    }
+    return (uint64_t) bytes * 1000000 / usecs;
+}
+
+/* SPI transfers per KB since xfers, in hundredths */
+static uint32_t
+sst26_bench_xfers(uint32_t bytes, uint32_t xfers)
+{
+    return (uint64_t) (g_sst26_stats.spi_xfers - xfers) * 1024 * 100 / bytes;
+}
+
+/**
+ * Read the sector at addr, one SPI transfer per byte and per byte of the
+ * command. The caller holds the bus.
+ */
+static int
+sst26_bench_read_bytewise(struct sst26_dev *dev, uint32_t addr, uint8_t *buf)
+{
+    int i;
+
+    if (sst26_wait_ready(dev)) {
+        return -1;
+    }
+
+    sst26_select(dev);
+    sst26_tx_val(dev, READ);
+    sst26_tx_val(dev, addr >> 16);
+    sst26_tx_val(dev, addr >> 8);
+    sst26_tx_val(dev, addr);
+    for (i = 0; i < SST26_SECTOR_SIZE; i++) {
+        buf[i] = sst26_tx_val(dev, 0xff);
+    }
+    sst26_deselect(dev);
+
+    return 0;
+}
+
+/**
+ * Program the erased sector at addr, one SPI transfer per byte and per
+ * byte of the commands. The caller holds the bus.
+ */
+static int
+sst26_bench_program_bytewise(struct sst26_dev *dev, uint32_t addr,
+                             const uint8_t *src)
+{
+    uint32_t page;
+    int i;
+
+    for (page = addr; page < addr + SST26_SECTOR_SIZE; page += SST26_PAGE_SIZE) {
+        if (sst26_wait_ready(dev)) {
+            return -1;
+        }
+
+        sst26_write_enable(dev);
+        sst26_select(dev);
+        sst26_tx_val(dev, PP);
+        sst26_tx_val(dev, page >> 16);
+        sst26_tx_val(dev, page >> 8);
+        sst26_tx_val(dev, page);
+        for (i = 0; i < SST26_PAGE_SIZE; i++) {
+            sst26_tx_val(dev, *src++);
+        }
+        sst26_deselect(dev);
+        sst26_op_start(dev, PP, page);
+    }
+
+    return sst26_wait_ready(dev);
+}
+
+/**
+ * Erase the sector at sector_addr and wait for the end of it. The caller
+ * holds the bus.
+ */
+static int
+sst26_bench_erase(struct sst26_dev *dev, uint32_t sector_addr)
+{
+    if (sst26_sector_erase(&dev->hal, sector_addr)) {
+        return -1;
+    }
+    return sst26_wait_ready(dev);
+}
+
+/**
+ * Measure the read and program throughput on the sector at sector_addr,
+ * through the driver and byte by byte as it used to be done.
+ *
+ * The content of the sector is read in the sector buffer and programmed
+ * back by each program pass, it is only lost on a reset during the bench.
+ * The bus is held all along, run it before the other users start.
+ */
+int
+sst26_bench(const struct hal_flash *hal_flash_dev, uint32_t sector_addr,
+            struct sst26_bench *res)
+{
+    struct sst26_dev *dev;
+    uint8_t *sbuf;
+    uint32_t start;
+    uint32_t xfers;
+    int rc;
+
+    dev = (struct sst26_dev *) hal_flash_dev;
+
+    if (sector_addr % SST26_SECTOR_SIZE ||
+        sector_addr >= dev->hal.hf_size) {
+        return -1;
+    }
+
+    os_mutex_pend(&g_sector_lock, OS_TIMEOUT_NEVER);
+    sst26_bus_acquire(dev);
+    sbuf = g_sector_buffer;
+
+    xfers = g_sst26_stats.spi_xfers;
+    start = os_cputime_get32();
+    rc = sst26_bench_read_bytewise(dev, sector_addr, sbuf);
+    res->read_bytewise_bps = sst26_bench_bps(SST26_SECTOR_SIZE, start);
+    res->read_bytewise_xfers = sst26_bench_xfers(SST26_SECTOR_SIZE, xfers);
+
+    if (rc == 0) {
+        xfers = g_sst26_stats.spi_xfers;
+        start = os_cputime_get32();
+        rc = sst26_read_array(dev, sector_addr, sbuf, SST26_SECTOR_SIZE);
+        res->read_bps = sst26_bench_bps(SST26_SECTOR_SIZE, start);
+        res->read_xfers = sst26_bench_xfers(SST26_SECTOR_SIZE, xfers);
+    }
+
+    if (rc == 0) {
+        rc = sst26_bench_erase(dev, sector_addr);
+    }
+    if (rc == 0) {
+        xfers = g_sst26_stats.spi_xfers;
+        start = os_cputime_get32();
+        rc = sst26_bench_program_bytewise(dev, sector_addr, sbuf);
+        res->program_bytewise_bps = sst26_bench_bps(SST26_SECTOR_SIZE, start);
+        res->program_bytewise_xfers = sst26_bench_xfers(SST26_SECTOR_SIZE,
+                                                        xfers);
+    }
+
+    if (rc == 0) {
+        rc = sst26_bench_erase(dev, sector_addr);
+    }
+    if (rc == 0) {
+        xfers = g_sst26_stats.spi_xfers;
+        start = os_cputime_get32();
+        rc = sst26_program(dev, sector_addr, sbuf, SST26_SECTOR_SIZE);
+        if (rc == 0) {
+            rc = sst26_wait_ready(dev);
+        }
+        res->program_bps = sst26_bench_bps(SST26_SECTOR_SIZE, start);
+        res->program_xfers = sst26_bench_xfers(SST26_SECTOR_SIZE, xfers);
+    }
+
+    sst26_bus_release(dev);
+    os_mutex_release(&g_sector_lock);
+
+    return rc;
+}
+#endif
+
 struct sst26_dev *
 sst26_default_config(void)
 {
@@ -355,7 +1619,7 @@ sst26_default_config(void)
 int
 sst26_init(const struct hal_flash *hal_flash_dev)
 {
-    //int rc;
+    int rc;
     struct hal_spi_settings *settings;
     struct sst26_dev *dev;
 
@@ -370,15 +1634,60 @@ sst26_init(const struct hal_flash *hal_flash_dev)
             return -1;
         }
         memcpy(settings, &sst26_default_settings, sizeof(sst26_default_settings));
-        sst26_default_settings.baudrate = dev->baudrate;
+        settings->baudrate = dev->baudrate;
+        dev->settings = settings;
     }
 
-    sst26_wait_ready(dev);
-    hal_gpio_write(dev->ss_pin, 0);
-    hal_spi_tx_val(dev->spi_num, ULBPR); // Global unlock
-    hal_gpio_write(dev->ss_pin, 1);
+#if MYNEWT_VAL(SST26_SIM)
+    sst26_sim_init();
+#else
+    hal_spi_disable(dev->spi_num);
+    rc = hal_spi_config(dev->spi_num, dev->settings);
+    if (rc) {
+        return rc;
+    }
 
-    sst26_wait_ready(dev);
+    /* The callback can only be set while the bus is disabled, it stays */
+    dev->txrx_cb_set = hal_spi_set_txrx_cb(dev->spi_num, sst26_bus_txrx_done,
+                                           dev) == 0;
+    hal_spi_enable(dev->spi_num);
 
-    return 0;
+    hal_gpio_init_out(dev->ss_pin, 1);
+#endif
+
+    if (!g_sst26_initialized) {
+        rc = stats_init_and_reg(STATS_HDR(g_sst26_stats),
+                                STATS_SIZE_INIT_PARMS(g_sst26_stats, STATS_SIZE_32),
+                                STATS_NAME_INIT_PARMS(sst26_stats), "sst26");
+        if (rc) {
+            return rc;
+        }
+        os_mutex_init(&g_sector_lock);
+        g_sst26_initialized = 1;
+    }
+
+    os_mutex_init(&dev->bus_lock);
+    dev->bus_depth = 0;
+    dev->stream = NULL;
+    dev->busy_op = 0;
+    dev->suspended = 0;
+    dev->done_cb = NULL;
+    dev->read_cb = NULL;
+
+    sst26_bus_acquire(dev);
+
+    rc = sst26_wait_ready(dev);
+    if (rc == 0) {
+        /* ULBPR is ignored by the chip unless write-enabled first */
+        sst26_write_enable(dev);
+        sst26_select(dev);
+        sst26_tx_val(dev, ULBPR); // Global unlock
+        sst26_deselect(dev);
+
+        rc = sst26_wait_ready(dev);
+    }
+
+    sst26_bus_release(dev);
+
+    return rc;
 }
@@ -0,0 +1,474 @@
+/*
+ * RAM-backed behavioural model of the SST26 SPI flash
+ *
+ * Stands in for the SPI bus when SST26_SIM is set, so the driver and the
+ * tasks using it can run on the native BSP. The model decodes the opcodes
+ * used by the driver and enforces the rules of the real chip:
+ * - blocks are protected at power up until ULBPR,
+ * - PP, SE, BE, CE and ULBPR need a preceding WREN,
+ * - programming can only clear bits, erase sets them back to 1,
+ * - a page program wraps inside its 256 bytes page,
+ * - only the status register can be read while the array is busy,
+ * - a sector or block erase can be suspended, the array can then be read
+ *   except for the block being erased, until the erase is resumed.
+ *
+ * Commands execute on CS rising edge like on the chip, and keep the array
+ * busy for the datasheet maximum of the operation.
+ *
+ * CHIC - China Hardware Innovation Camp - Todoo
+ * https://chi.camp/projects/todoo/
+*/
+
+#include "syscfg/syscfg.h"
+
+#if MYNEWT_VAL(SST26_SIM)
+
+#include <os/os.h>
+
+#include <SST26/SST26_sim.h>
+#include "sst26_priv.h"
+
+#include <string.h>
+
+/* SST26VF032B maximum timings in us */
+#define SIM_T_PP_US     1500
+#define SIM_T_SE_US     25000
+#define SIM_T_BE_US     25000
+#define SIM_T_SCE_US    50000
+#define SIM_T_WS_US     10
+
+struct sst26_sim {
+    uint8_t ready;
+    uint8_t selected;
+    uint8_t ignore;             /* Current command rejected */
+    uint8_t cmd;
+    uint32_t nbytes;            /* Bytes received in the current command */
+    uint32_t addr;
+
+    uint8_t wel;
+    uint8_t locked;
+
+    uint8_t busy;
+    uint32_t busy_start;
+    uint32_t busy_ticks;
+
+    /* Erase in progress or on suspend */
+    uint8_t erasing;
+    uint8_t suspended;
+    uint32_t erase_start;
+    uint32_t erase_size;
+    uint32_t erase_left;        /* cputime ticks left when suspended */
+
+    /* Page program latch */
+    uint8_t page[SST26_PAGE_SIZE];
+    uint8_t page_used[SST26_PAGE_SIZE];
+};
+
+static struct sst26_sim sim;
+static struct sst26_sim_stats sim_stats;
+static uint8_t sim_mem[SST26_CHIP_SIZE];
+
+static int
+sst26_sim_is_busy(void)
+{
+    uint32_t elapsed;
+
+    if (sim.busy) {
+        elapsed = os_cputime_get32() - sim.busy_start;
+        if (elapsed >= sim.busy_ticks) {
+            sim.busy = 0;
+            if (!sim.suspended) {
+                sim.erasing = 0;
+            }
+        }
+    }
+
+    return sim.busy;
+}
+
+static void
+sst26_sim_start_busy(uint32_t usecs)
+{
+    sim.busy = 1;
+    sim.busy_start = os_cputime_get32();
+    sim.busy_ticks = os_cputime_usecs_to_ticks(usecs);
+    sim_stats.busy_us += usecs;
+}
+
+/**
+ * Checks shared by every command that modifies the array. WEL is consumed
+ * whether the command succeeds or not.
+ */
+static int
+sst26_sim_write_allowed(void)
+{
+    if (!sim.wel) {
+        sim_stats.wel_errors++;
+        return 0;
+    }
+    sim.wel = 0;
+
+    if (sim.locked) {
+        sim_stats.protect_errors++;
+        return 0;
+    }
+
+    return 1;
+}
+
+static void
+sst26_sim_program(void)
+{
+    uint32_t page_addr;
+    uint32_t n;
+    uint8_t *cell;
+
+    page_addr = sim.addr & ~(SST26_PAGE_SIZE - 1);
+
+    for (n = 0; n < SST26_PAGE_SIZE; n++) {
+        if (!sim.page_used[n]) {
+            continue;
+        }
+        cell = &sim_mem[page_addr + n];
+        if ((*cell & sim.page[n]) != sim.page[n]) {
+            sim_stats.program_errors++;
+        }
+        *cell &= sim.page[n];
+    }
+
+    sim_stats.page_programs++;
+    sst26_sim_start_busy(SIM_T_PP_US);
+}
+
+static void
+sst26_sim_erase(uint32_t start, uint32_t size, uint32_t usecs)
+{
+    memset(&sim_mem[start], 0xff, size);
+    sst26_sim_start_busy(usecs);
+    sim.erasing = 1;
+    sim.erase_start = start;
+    sim.erase_size = size;
+}
+
+static void
+sst26_sim_suspend(void)
+{
+    uint32_t elapsed;
+
+    /* Ignored by the chip when nothing suspendable runs */
+    if (!sst26_sim_is_busy() || !sim.erasing || sim.suspended ||
+        sim.erase_size == SST26_CHIP_SIZE) {
+        return;
+    }
+
+    elapsed = os_cputime_get32() - sim.busy_start;
+    sim.erase_left = sim.busy_ticks - elapsed;
+    sim.suspended = 1;
+    sim_stats.suspends++;
+
+    /* Suspend latency */
+    sim.busy_start = os_cputime_get32();
+    sim.busy_ticks = os_cputime_usecs_to_ticks(SIM_T_WS_US);
+}
+
+static void
+sst26_sim_resume(void)
+{
+    if (!sim.suspended) {
+        return;
+    }
+
+    sim.suspended = 0;
+    sim.busy = 1;
+    sim.busy_start = os_cputime_get32();
+    sim.busy_ticks = sim.erase_left;
+}
+
+/* Command completion on CS rising edge */
+static void
+sst26_sim_execute(void)
+{
+    uint32_t start;
+    uint32_t size;
+
+    if (sim.ignore || sim.nbytes == 0) {
+        return;
+    }
+
+    switch (sim.cmd) {
+    case WREN:
+        sim.wel = 1;
+        break;
+
+    case ULBPR:
+        if (!sim.wel) {
+            sim_stats.wel_errors++;
+            break;
+        }
+        sim.wel = 0;
+        sim.locked = 0;
+        break;
+
+    case PP:
+        /* Command aborted before any data byte */
+        if (sim.nbytes <= 4) {
+            break;
+        }
+        if (sim.suspended) {
+            sim_stats.suspend_errors++;
+            break;
+        }
+        if (sst26_sim_write_allowed()) {
+            sst26_sim_program();
+        }
+        break;
+
+    case SE:
+        if (sim.nbytes != 4) {
+            break;
+        }
+        if (sim.suspended) {
+            sim_stats.suspend_errors++;
+            break;
+        }
+        if (sst26_sim_write_allowed()) {
+            start = sim.addr & ~(SST26_SECTOR_SIZE - 1);
+            sst26_sim_erase(start, SST26_SECTOR_SIZE, SIM_T_SE_US);
+            sim_stats.sector_erases++;
+        }
+        break;
+
+    case BE:
+        if (sim.nbytes != 4) {
+            break;
+        }
+        if (sim.suspended) {
+            sim_stats.suspend_errors++;
+            break;
+        }
+        if (sst26_sim_write_allowed()) {
+            sst26_block_bounds(sim.addr, &start, &size);
+            sst26_sim_erase(start, size, SIM_T_BE_US);
+            sim_stats.block_erases++;
+        }
+        break;
+
+    case WSUSP:
+        sst26_sim_suspend();
+        break;
+
+    case WRESU:
+        sst26_sim_resume();
+        break;
+
+    case CE:
+        if (sim.suspended) {
+            sim_stats.suspend_errors++;
+            break;
+        }
+        if (sst26_sim_write_allowed()) {
+            sst26_sim_erase(0, SST26_CHIP_SIZE, SIM_T_SCE_US);
+            sim_stats.chip_erases++;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+static uint8_t
+sst26_sim_status(void)
+{
+    uint8_t status;
+
+    status = 0;
+    if (sst26_sim_is_busy()) {
+        status |= STATUS_BUSY | STATUS_BUSY0;
+    }
+    if (sim.wel) {
+        status |= STATUS_WEL;
+    }
+    if (sim.suspended) {
+        status |= STATUS_WSE;
+    }
+
+    return status;
+}
+
+static uint8_t
+sst26_sim_byte(uint8_t val)
+{
+    uint32_t idx;
+    uint32_t off;
+    uint8_t out;
+
+    out = 0xff;
+    idx = sim.nbytes++;
+
+    if (idx == 0) {
+        sim.cmd = val;
+        sim.addr = 0;
+        if (val != STATUS_REGISTER && val != WSUSP && sst26_sim_is_busy()) {
+            sim_stats.busy_errors++;
+            sim.ignore = 1;
+        }
+        if (val == PP) {
+            memset(sim.page_used, 0, sizeof(sim.page_used));
+        }
+        return out;
+    }
+
+    if (sim.ignore) {
+        return out;
+    }
+
+    switch (sim.cmd) {
+    case STATUS_REGISTER:
+        out = sst26_sim_status();
+        break;
+
+    case READ:
+        if (idx < 4) {
+            sim.addr = (sim.addr << 8) | val;
+        } else {
+            if (idx == 4) {
+                sim_stats.reads++;
+            }
+            out = sim_mem[sim.addr];
+            /* The block on erase suspend reads back garbage */
+            if (sim.suspended && sim.addr - sim.erase_start < sim.erase_size) {
+                sim_stats.suspend_errors++;
+                out = 0x00;
+            }
+            sim.addr = (sim.addr + 1) & (SST26_CHIP_SIZE - 1);
+        }
+        break;
+
+    case PP:
+        if (idx < 4) {
+            sim.addr = (sim.addr << 8) | val;
+            if (idx == 3) {
+                sim.addr &= SST26_CHIP_SIZE - 1;
+            }
+        } else {
+            /* Data past the end of the page wraps to its beginning */
+            off = (sim.addr + idx - 4) & (SST26_PAGE_SIZE - 1);
+            sim.page[off] = val;
+            sim.page_used[off] = 1;
+        }
+        break;
+
+    case SE:
+    case BE:
+        if (idx < 4) {
+            sim.addr = (sim.addr << 8) | val;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return out;
+}
+
+void
+sst26_sim_select(void)
+{
+    if (sim.selected) {
+        return;
+    }
+
+    sim.selected = 1;
+    sim.ignore = 0;
+    sim.nbytes = 0;
+    sim_stats.transactions++;
+}
+
+void
+sst26_sim_deselect(void)
+{
+    if (!sim.selected) {
+        return;
+    }
+
+    sst26_sim_execute();
+    sim.selected = 0;
+}
+
+void
+sst26_sim_txrx(const uint8_t *txbuf, uint8_t *rxbuf, int len)
+{
+    int i;
+    uint8_t val;
+
+    for (i = 0; i < len; i++) {
+        /* Same as the real chip: SO is high-Z when not selected */
+        val = 0xff;
+        if (sim.selected) {
+            val = sst26_sim_byte(txbuf ? txbuf[i] : 0xff);
+        }
+        if (rxbuf) {
+            rxbuf[i] = val;
+        }
+    }
+
+    sim_stats.bytes += len;
+}
+
+/**
+ * Power up the model: array erased, all blocks protected. Only the first
+ * call has an effect so every task can init the driver.
+ */
+void
+sst26_sim_init(void)
+{
+    if (sim.ready) {
+        return;
+    }
+
+    memset(&sim, 0, sizeof(sim));
+    memset(&sim_stats, 0, sizeof(sim_stats));
+    memset(sim_mem, 0xff, sizeof(sim_mem));
+    sim.locked = 1;
+    sim.ready = 1;
+}
+
+/**
+ * Power cycle the model and clear its stats, for the tests to start from
+ * a known chip. Drivers set up before have to be initialized again.
+ */
+void
+sst26_sim_reset(void)
+{
+    sim.ready = 0;
+    sst26_sim_init();
+}
+
+/**
+ * Preload the array, e.g. with the fixed pictures, bypassing the command
+ * set and its timings.
+ */
+void
+sst26_sim_load(uint32_t addr, const void *buf, uint32_t len)
+{
+    sst26_sim_init();
+
+    if (addr >= SST26_CHIP_SIZE) {
+        return;
+    }
+    if (len > SST26_CHIP_SIZE - addr) {
+        len = SST26_CHIP_SIZE - addr;
+    }
+
+    memcpy(&sim_mem[addr], buf, len);
+}
+
+const struct sst26_sim_stats *
+sst26_sim_get_stats(void)
+{
+    return &sim_stats;
+}
+
+#endif /* MYNEWT_VAL(SST26_SIM) */
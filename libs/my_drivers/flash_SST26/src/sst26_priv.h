@@ -0,0 +1,65 @@
+/*
+ * Definitions shared by the SST26 driver and its simulator
+ *
+ * CHIC - China Hardware Innovation Camp - Todoo
+ * https://chi.camp/projects/todoo/
+*/
+
+#ifndef __SST26_PRIV_H__
+#define __SST26_PRIV_H__
+
+#include <stdint.h>
+#include "syscfg/syscfg.h"
+
+#define ULBPR           0x98
+#define SE              0x20    /**< Erase 4 KBytes of Memory Array */
+#define BE              0xD8    /**< Erase 64, 32 or 8 KBytes of Memory Array */
+#define CE              0xC7    /**< Erase Full Array */
+#define PP              0x02    /**< Page Program */
+#define READ            0x03    /**< Read Memory */
+#define WREN            0x06    /**< Write Enable */
+#define WSUSP           0xB0    /**< Suspend Program/Erase */
+#define WRESU           0x30    /**< Resume Program/Erase */
+
+#define STATUS_REGISTER 0x05
+
+#define STATUS_BUSY     (1 << 7)
+#define STATUS_WEL      (1 << 1)
+#define STATUS_BUSY0    (1 << 0)    /**< Same as STATUS_BUSY, bit 0 copy */
+#define STATUS_WSE      (1 << 2)    /**< Erase suspended */
+#define STATUS_WSP      (1 << 3)    /**< Program suspended */
+
+#define SST26_CHIP_SIZE     (4 * 1024 * 1024)
+#define SST26_SECTOR_SIZE   4096
+#define SST26_PAGE_SIZE     256
+
+/**
+ * SST26VF032B block map used by BE: four 8 KB blocks and one 32 KB block
+ * at each end of the array, 64 KB blocks in between.
+ */
+static inline void
+sst26_block_bounds(uint32_t addr, uint32_t *start, uint32_t *size)
+{
+    uint32_t sz;
+
+    addr &= SST26_CHIP_SIZE - 1;
+
+    if (addr < 0x008000 || addr >= SST26_CHIP_SIZE - 0x008000) {
+        sz = 0x2000;
+    } else if (addr < 0x010000 || addr >= SST26_CHIP_SIZE - 0x010000) {
+        sz = 0x8000;
+    } else {
+        sz = 0x10000;
+    }
+
+    *start = addr & ~(sz - 1);
+    *size = sz;
+}
+
+#if MYNEWT_VAL(SST26_SIM)
+void sst26_sim_select(void);
+void sst26_sim_deselect(void);
+void sst26_sim_txrx(const uint8_t *txbuf, uint8_t *rxbuf, int len);
+#endif
+
+#endif /* __SST26_PRIV_H__ */
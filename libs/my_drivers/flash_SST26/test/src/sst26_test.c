@@ -0,0 +1,294 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "syscfg/syscfg.h"
+#include "sysinit/sysinit.h"
+#include "os/os.h"
+#include "testutil/testutil.h"
+#include <SST26/SST26.h>
+#include <SST26/SST26_sim.h>
+
+/* Outside of the 64 KB block of SST26_TEST_ERASED */
+#define SST26_TEST_DATA         0x010000
+#define SST26_TEST_ERASED       0x100000
+#define SST26_TEST_SECTOR       4096
+
+/* Longer than any erase of the model */
+#define SST26_TEST_ERASE_US     60000
+
+/*
+ * Bound on a read issued while an erase runs, a quarter of the 25 ms
+ * sector or block erase of the model. The driver needs about 600 us: the
+ * erase runs 500 us after a resume before it is suspended again, plus the
+ * polls for the suspend. The host running the test can still schedule it
+ * out past the bound now and then: most reads of a case must be within it.
+ */
+#define SST26_TEST_READS        8
+#define SST26_TEST_READ_MAX_US  6250
+
+static uint8_t sst26_test_data[SST26_TEST_SECTOR];
+static uint8_t sst26_test_buf[SST26_TEST_SECTOR];
+
+/*
+ * Power cycle the model, then set up a driver on it with a data sector
+ * and a sector to erase.
+ */
+static struct sst26_dev *
+sst26_test_init(void)
+{
+    struct sst26_dev *dev;
+    int i;
+
+    sst26_sim_reset();
+
+    dev = sst26_default_config();
+    TEST_ASSERT_FATAL(dev != NULL);
+    TEST_ASSERT_FATAL(sst26_init(&dev->hal) == 0);
+
+    for (i = 0; i < SST26_TEST_SECTOR; i++) {
+        sst26_test_data[i] = i * 7 + 1;
+    }
+    sst26_sim_load(SST26_TEST_DATA, sst26_test_data, SST26_TEST_SECTOR);
+    memset(sst26_test_buf, 0xa5, SST26_TEST_SECTOR);
+    sst26_sim_load(SST26_TEST_ERASED, sst26_test_buf, SST26_TEST_SECTOR);
+
+    return dev;
+}
+
+static uint32_t
+sst26_test_usecs(uint32_t start)
+{
+    return os_cputime_ticks_to_usecs(os_cputime_get32() - start);
+}
+
+/*
+ * Check a read issued while the erase runs: the erase is still going on
+ * after it, so the read did not wait for its end, and it took less than
+ * SST26_TEST_READ_MAX_US or counts in *slow.
+ */
+static void
+sst26_test_read_time(struct sst26_dev *dev, uint32_t start, int *slow)
+{
+    if (sst26_test_usecs(start) >= SST26_TEST_READ_MAX_US) {
+        (*slow)++;
+    }
+    TEST_ASSERT(dev->busy_op != 0);
+}
+
+/*
+ * The reads went through suspends without an error of the model, and the
+ * erase completed once they were done.
+ */
+static void
+sst26_test_check_erased(struct sst26_dev *dev)
+{
+    const struct sst26_sim_stats *stats;
+    int i;
+
+    stats = sst26_sim_get_stats();
+    TEST_ASSERT(stats->suspends > 0);
+
+    os_cputime_delay_usecs(SST26_TEST_ERASE_US);
+
+    TEST_ASSERT(sst26_read(&dev->hal, SST26_TEST_ERASED, sst26_test_buf,
+                           SST26_TEST_SECTOR) == 0);
+    for (i = 0; i < SST26_TEST_SECTOR; i++) {
+        if (sst26_test_buf[i] != 0xff) {
+            break;
+        }
+    }
+    TEST_ASSERT(i == SST26_TEST_SECTOR);
+
+    TEST_ASSERT(stats->suspend_errors == 0);
+    TEST_ASSERT(stats->busy_errors == 0);
+
+    free(dev);
+}
+
+/*
+ * Reads outside of the sector being erased suspend the erase instead of
+ * waiting for it, and get the data back.
+ */
+TEST_CASE(sst26_test_read_during_erase)
+{
+    struct sst26_dev *dev;
+    uint32_t start;
+    int slow;
+    int i;
+
+    dev = sst26_test_init();
+    slow = 0;
+
+    TEST_ASSERT_FATAL(sst26_sector_erase(&dev->hal, SST26_TEST_ERASED) == 0);
+
+    for (i = 0; i < SST26_TEST_READS; i++) {
+        memset(sst26_test_buf, 0, SST26_TEST_SECTOR);
+        start = os_cputime_get32();
+        TEST_ASSERT(sst26_read(&dev->hal, SST26_TEST_DATA, sst26_test_buf,
+                               SST26_TEST_SECTOR) == 0);
+        sst26_test_read_time(dev, start, &slow);
+        TEST_ASSERT(memcmp(sst26_test_buf, sst26_test_data,
+                           SST26_TEST_SECTOR) == 0);
+    }
+    TEST_ASSERT(slow < SST26_TEST_READS / 2);
+
+    sst26_test_check_erased(dev);
+}
+
+/*
+ * Same with a stream, which keeps the erase suspended between its reads.
+ */
+TEST_CASE(sst26_test_stream_during_erase)
+{
+    struct sst26_stream stream;
+    struct sst26_dev *dev;
+    uint32_t start;
+    int slow;
+    int i;
+
+    dev = sst26_test_init();
+    slow = 0;
+
+    TEST_ASSERT_FATAL(sst26_erase_range(&dev->hal, SST26_TEST_ERASED,
+                                        SST26_TEST_SECTOR) == 0);
+
+    memset(sst26_test_buf, 0, SST26_TEST_SECTOR);
+    TEST_ASSERT_FATAL(sst26_stream_open(dev, &stream, SST26_TEST_DATA) == 0);
+    for (i = 0; i < SST26_TEST_SECTOR; i += 64) {
+        start = os_cputime_get32();
+        TEST_ASSERT(sst26_stream_read(&stream, sst26_test_buf + i, 64) == 0);
+        sst26_test_read_time(dev, start, &slow);
+    }
+    sst26_stream_close(&stream);
+    TEST_ASSERT(slow < SST26_TEST_SECTOR / 64 / 2);
+    TEST_ASSERT(memcmp(sst26_test_buf, sst26_test_data,
+                       SST26_TEST_SECTOR) == 0);
+
+    sst26_test_check_erased(dev);
+}
+
+static void
+sst26_test_read_done(void *arg, int len)
+{
+    *(int *) arg = len;
+}
+
+/*
+ * Same with sst26_read_noblock(), which leaves the erase suspended until
+ * the bus is released.
+ */
+TEST_CASE(sst26_test_read_noblock_during_erase)
+{
+    struct sst26_dev *dev;
+    uint32_t start;
+    int slow;
+    int done;
+    int i;
+
+    dev = sst26_test_init();
+    slow = 0;
+
+    /* Only for the bus holder */
+    done = 0;
+    TEST_ASSERT(sst26_read_noblock(dev, SST26_TEST_DATA, sst26_test_buf,
+                                   SST26_TEST_SECTOR, sst26_test_read_done,
+                                   &done) == -1);
+    TEST_ASSERT(done == 0);
+
+    TEST_ASSERT_FATAL(sst26_sector_erase(&dev->hal, SST26_TEST_ERASED) == 0);
+
+    for (i = 0; i < SST26_TEST_READS; i++) {
+        memset(sst26_test_buf, 0, SST26_TEST_SECTOR);
+        done = 0;
+        sst26_bus_acquire(dev);
+        start = os_cputime_get32();
+        TEST_ASSERT(sst26_read_noblock(dev, SST26_TEST_DATA, sst26_test_buf,
+                                       SST26_TEST_SECTOR, sst26_test_read_done,
+                                       &done) == 0);
+        TEST_ASSERT(done == SST26_TEST_SECTOR);
+        sst26_test_read_time(dev, start, &slow);
+        TEST_ASSERT(dev->suspended);
+        sst26_bus_release(dev);
+        TEST_ASSERT(!dev->suspended);
+
+        TEST_ASSERT(memcmp(sst26_test_buf, sst26_test_data,
+                           SST26_TEST_SECTOR) == 0);
+    }
+    TEST_ASSERT(slow < SST26_TEST_READS / 2);
+
+    sst26_test_check_erased(dev);
+}
+
+/*
+ * sst26_bench() leaves the sector as it was, and the driver needs far
+ * fewer SPI transfers than one per byte: the READ command and the data
+ * plus a status poll, and per page the WREN, PP command and data. The
+ * status polls of the page programs, every 50 us, are the same both ways
+ * and most of what is left, about 60 transfers per page on the model.
+ */
+TEST_CASE(sst26_test_bench)
+{
+    struct sst26_bench bench;
+    struct sst26_dev *dev;
+
+    dev = sst26_test_init();
+
+    TEST_ASSERT_FATAL(sst26_bench(&dev->hal, SST26_TEST_DATA, &bench) == 0);
+
+    TEST_ASSERT(bench.read_xfers <= 100);
+    TEST_ASSERT(bench.read_bytewise_xfers >= 102400);
+    TEST_ASSERT(bench.program_xfers * 3 < bench.program_bytewise_xfers);
+    TEST_ASSERT(bench.read_bps > 0 && bench.program_bps > 0);
+
+    TEST_ASSERT(sst26_read(&dev->hal, SST26_TEST_DATA, sst26_test_buf,
+                           SST26_TEST_SECTOR) == 0);
+    TEST_ASSERT(memcmp(sst26_test_buf, sst26_test_data,
+                       SST26_TEST_SECTOR) == 0);
+
+    TEST_ASSERT(sst26_sim_get_stats()->program_errors == 0);
+    TEST_ASSERT(sst26_sim_get_stats()->busy_errors == 0);
+
+    free(dev);
+}
+
+TEST_SUITE(sst26_test_suite)
+{
+    sst26_test_read_during_erase();
+    sst26_test_stream_during_erase();
+    sst26_test_read_noblock_during_erase();
+    sst26_test_bench();
+}
+
+#if MYNEWT_VAL(SELFTEST)
+int
+main(int argc, char **argv)
+{
+    ts_config.ts_print_results = 1;
+    tu_init();
+
+    sysinit();
+
+    sst26_test_suite();
+
+    return tu_any_failed;
+}
+#endif